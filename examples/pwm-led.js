@@ -8,7 +8,7 @@ var pin = 12;		/* P12/GPIO18 */
 var range = 1024;	/* LEDs can quickly hit max brightness, so only use */
 var max = 128;		/*   the bottom 8th of a larger scale */
 var clockdiv = 8;	/* Clock divider (PWM refresh rate), 8 == 2.4MHz */
-var interval = 5;	/* setInterval timer, speed of pulses */
+var duration = 640;	/* Duration of each fade in milliseconds */
 var times = 5;		/* How many times to pulse before exiting */
 
 /*
@@ -19,22 +19,19 @@ rpio.pwmSetClockDivider(clockdiv);
 rpio.pwmSetRange(pin, range);
 
 /*
- * Repeatedly pulse from low to high and back again until times runs out.
+ * Repeatedly fade from low to high and back again until times runs out.  The
+ * fades run on a background thread, leaving the event loop free.
  */
-var direction = 1;
-var data = 0;
-var pulse = setInterval(function() {
-	rpio.pwmSetData(pin, data);
-	if (data === 0) {
-		direction = 1;
-		if (times-- === 0) {
-			clearInterval(pulse);
-			rpio.open(pin, rpio.INPUT);
-			return;
-		}
-	} else if (data === max) {
-		direction = -1;
+function pulse()
+{
+	if (times-- === 0) {
+		rpio.open(pin, rpio.INPUT);
+		return;
 	}
-	data += direction;
-}, interval, data, direction, times);
 
+	rpio.pwmRamp(pin, 0, max, duration, function() {
+		rpio.pwmRamp(pin, max, 0, duration, pulse);
+	});
+}
+
+pulse();
@@ -18,6 +18,7 @@ var binding = require('bindings')('rpio');
 var fs = require('fs');
 var util = require('util');
 var EventEmitter = require('events').EventEmitter;
+var Writable = require('stream').Writable;
 
 /*
  * Event Emitter gloop.
@@ -63,6 +64,31 @@ rpio.prototype.POLL_LOW = 0x1;	/* Falling edge detect */
 rpio.prototype.POLL_HIGH = 0x2;	/* Rising edge detect */
 rpio.prototype.POLL_BOTH = 0x3;	/* POLL_LOW | POLL_HIGH */
 
+/*
+ * GPIO banks for whole-port access.  Must be kept in sync with rpio.cc.
+ */
+rpio.prototype.PORT_BANK0 = 0x0;	/* GPIO0 - GPIO31 */
+rpio.prototype.PORT_BANK1 = 0x1;	/* GPIO32 - GPIO53 */
+rpio.prototype.PORT_ALL = 0x2;		/* Both banks, as a BigInt */
+
+/*
+ * PWM ramp easing curves.  Must be kept in sync with rpio.cc.
+ */
+rpio.prototype.EASE_LINEAR = 0x0;
+rpio.prototype.EASE_IN = 0x1;
+rpio.prototype.EASE_OUT = 0x2;
+rpio.prototype.EASE_IN_OUT = 0x3;
+
+/*
+ * General purpose clock sources.  Must match bcm2835GPClockSource.
+ */
+rpio.prototype.GPCLK_SRC_GND = 0x0;
+rpio.prototype.GPCLK_SRC_OSC = 0x1;
+rpio.prototype.GPCLK_SRC_PLLA = 0x4;
+rpio.prototype.GPCLK_SRC_PLLC = 0x5;
+rpio.prototype.GPCLK_SRC_PLLD = 0x6;
+rpio.prototype.GPCLK_SRC_HDMI = 0x7;
+
 /*
  * Reset pin status on close (default), or preserve current status.
  */
@@ -94,7 +120,8 @@ var rpio_options = {
 	gpiomem: true,
 	mapping: 'physical',
 	mock: false,
-	close_on_exit: true
+	close_on_exit: true,
+	poll_period: 50
 };
 
 /* Default mock mode if hardware is unsupported. */
@@ -135,6 +162,22 @@ function bindcall4(bindfunc, arg1, arg2, arg3, arg4)
 	return bindfunc(arg1, arg2, arg3, arg4);
 }
 
+function bindcall5(bindfunc, arg1, arg2, arg3, arg4, arg5)
+{
+	if (rpio_options.mock)
+		return;
+
+	return bindfunc(arg1, arg2, arg3, arg4, arg5);
+}
+
+function bindcall6(bindfunc, arg1, arg2, arg3, arg4, arg5, arg6)
+{
+	if (rpio_options.mock)
+		return;
+
+	return bindfunc(arg1, arg2, arg3, arg4, arg5, arg6);
+}
+
 function warn(msg)
 {
 	console.error('WARNING: ' + msg);
@@ -513,22 +556,75 @@ var pinmaps = {
 
 /*
  * Pin event polling.  We track which pins are being monitored, and create a
- * bitmask for efficient checks.  The event_poll function is executed in a
- * setInterval() context whenever any pins are being monitored, and emits
- * events when their EDS bit is set.
+ * bitmask for efficient checks, one 32-bit word for each of GPIO 0-31 and
+ * GPIO 32-53 as JavaScript bitwise operators only work on 32 bits.  A native
+ * watcher thread samples the EDS register every poll_period microseconds
+ * whenever any pins are being monitored, and queues a timestamped entry for
+ * each edge it sees.  The
+ * queue is handed to event_poll in batches as a Float64Array of
+ * [gpio, level, usecs] triples.
  */
 var event_pins = {};
-var event_mask = 0x0;
+var event_gpiopins = [];
+var event_mask = [0x0, 0x0];
 var event_running = false;
 
-function event_poll()
+function event_poll(edges, dropped)
+{
+	var fired = [];
+	var firedmask = [0x0, 0x0];
+	var gpiopin, bit, i;
+
+	/*
+	 * Rewrite each entry in terms of the user's pin mapping, and make a
+	 * note of which pins need their callback run.
+	 */
+	for (i = 0; i < edges.length; i += 3) {
+		gpiopin = edges[i];
+		bit = 1 << (gpiopin & 31);
+		edges[i] = event_gpiopins[gpiopin];
+		if (!(firedmask[gpiopin >> 5] & bit) && gpiopin in event_pins) {
+			firedmask[gpiopin >> 5] |= bit;
+			fired.push(event_pins[gpiopin]);
+		}
+	}
+
+	if (module.exports.listenerCount('edges') > 0)
+		module.exports.emit('edges', edges, dropped);
+
+	for (i = 0; i < fired.length; i++)
+		fired[i].cb(fired[i].pin);
+}
+
+/*
+ * In mock mode there is no watcher thread, so instead treat a write which
+ * changes the level of a polled pin as an external edge, and deliver any
+ * such edges together on the next turn of the event loop.
+ */
+var mock_edges = [];
+
+function mock_edge(gpiopin, value)
 {
-	var active = bindcall(binding.gpio_event_poll, event_mask);
+	var level = value ? 1 : 0;
+	var ev = event_pins[gpiopin];
+
+	if (!ev || level === (mockmap[gpiopin] ? 1 : 0))
+		return;
 
-	for (gpiopin in event_pins) {
-		if (active & (1 << gpiopin))
-			module.exports.emit('pin' + gpiopin);
+	if (!(ev.direction & (level ? rpio.prototype.POLL_HIGH
+	    : rpio.prototype.POLL_LOW)))
+		return;
+
+	if (mock_edges.length === 0) {
+		setImmediate(function() {
+			var edges = new Float64Array(mock_edges);
+
+			mock_edges = [];
+			event_poll(edges, 0);
+		});
 	}
+
+	mock_edges.push(gpiopin, level, rpio.prototype.now());
 }
 
 /*
@@ -706,6 +802,49 @@ function pin_to_gpio(pin)
 	return pincache[pin];
 }
 
+/*
+ * Translate an array of pins to GPIO numbers for port access, noting which
+ * banks are involved so that each only needs to be accessed once.
+ */
+function pins_to_port(pins)
+{
+	var port = {gpiopins: [], banks: [false, false]};
+	var gpiopin;
+
+	if (pins.length > 32)
+		throw new Error('Port access is limited to 32 pins');
+
+	for (var i = 0; i < pins.length; i++) {
+		gpiopin = pin_to_gpio(pins[i]);
+		if (gpiopin > 53)
+			throw new Error('Pin ' + pins[i] + ' does not support port access');
+		port.gpiopins.push(gpiopin);
+		port.banks[gpiopin >> 5] = true;
+	}
+
+	return port;
+}
+
+function mock_read_port(bank)
+{
+	var word = 0;
+
+	for (var gpiopin in mockmap) {
+		if ((gpiopin >> 5) === bank && mockmap[gpiopin])
+			word |= (1 << (gpiopin & 31));
+	}
+
+	return word >>> 0;
+}
+
+function read_port(bank)
+{
+	if (rpio_options.mock)
+		return mock_read_port(bank);
+
+	return bindcall(binding.gpio_read_port, bank);
+}
+
 function check_sys_gpio(pin)
 {
 	if (fs.existsSync('/sys/class/gpio/gpio' + pin))
@@ -900,177 +1039,264 @@ rpio.prototype.readbuf = function(pin, buf, len, mode)
 	return bindcall4(binding.gpio_readbuf, pin_to_gpio(pin), buf, len, mode ? 1 : 0);
 }
 
-rpio.prototype.write = function(pin, value)
+rpio.prototype.readbufTimed = function(pin, buf, stamps, every, len, mode)
 {
-	if (rpio_options.mock)
-		return mockmap[pin_to_gpio(pin)] = value
-
-	return bindcall2(binding.gpio_write, pin_to_gpio(pin), value);
-}
+	if (every === undefined)
+		every = 1;
 
-rpio.prototype.writebuf = function(pin, buf, len)
-{
 	if (len === undefined)
 		len = buf.length;
 
 	if (len > buf.length)
 		throw new Error('Buffer not large enough to accommodate request');
 
-	return bindcall3(binding.gpio_writebuf, pin_to_gpio(pin), buf, len);
-}
+	if (!(every >= 1 && every % 1 === 0))
+		throw new Error('Timestamp interval must be a positive integer');
 
-rpio.prototype.readpad = function(group)
-{
-	if (rpio_options.gpiomem)
-		throw new Error('Pad control not available in gpiomem mode');
+	if (Math.ceil(len / every) > stamps.length)
+		throw new Error('Timestamp array not large enough to accommodate request');
 
-	return bindcall(binding.gpio_pad_read, group);
+	return bindcall6(binding.gpio_readbuf_timed, pin_to_gpio(pin), buf, len,
+	    stamps, every, mode ? 1 : 0);
 }
 
-rpio.prototype.writepad = function(group, control)
+rpio.prototype.readEdges = function(pin, edges, timeout, mode)
 {
-	if (rpio_options.gpiomem)
-		throw new Error('Pad control not available in gpiomem mode');
+	var max = Math.floor(edges.length / 2);
 
-	bindcall2(binding.gpio_pad_write, group, control);
+	if (max === 0)
+		throw new Error('Edge array not large enough to accommodate request');
+
+	if (!(timeout > 0))
+		throw new Error('Timeout must be a positive number of microseconds');
+
+	/* In mock mode the pin never changes, so only the initial level. */
+	if (rpio_options.mock) {
+		edges[0] = 0;
+		edges[1] = rpio.prototype.read(pin);
+		return 1;
+	}
+
+	return bindcall5(binding.gpio_read_edges, pin_to_gpio(pin), edges, max,
+	    timeout, mode ? 1 : 0);
 }
 
-rpio.prototype.pud = function(pin, state)
+rpio.prototype.sample = function(pin, buf, rate, len, mode)
 {
-	bindcall2(binding.gpio_pud, pin_to_gpio(pin), state);
+	if (len === undefined)
+		len = buf.length;
+
+	if (len > buf.length)
+		throw new Error('Buffer not large enough to accommodate request');
+
+	return bindcall5(binding.gpio_sample, pin_to_gpio(pin), buf, len, rate,
+	    mode ? 1 : 0);
 }
 
-rpio.prototype.poll = function(pin, cb, direction)
+rpio.prototype.samplePort = function(bank, words, rate, len)
 {
-	var gpiopin = pin_to_gpio(pin);
+	var masks = [0x0, 0x0];
 
-	if (direction === undefined)
-		direction = rpio.prototype.POLL_BOTH;
+	if (len === undefined)
+		len = words.length;
 
-	/*
-	 * If callback is a function, set up pin for polling, otherwise
-	 * clear it.
-	 */
-	if (typeof(cb) === 'function') {
-		if (gpiopin in event_pins)
-			throw new Error('Pin ' + pin + ' is already listening for events.');
+	if (len > words.length)
+		throw new Error('Array not large enough to accommodate request');
 
-		bindcall2(binding.gpio_event_set, gpiopin, direction);
+	if (!rate)
+		throw new Error('Sample rate must be non-zero');
+
+	if (bank !== rpio.prototype.PORT_BANK0 &&
+	    bank !== rpio.prototype.PORT_BANK1)
+		throw new Error('Invalid bank ' + bank);
 
-		var pincb = function() {
-			cb(pin);
-		};
-		module.exports.on('pin' + gpiopin, pincb);
+	masks[bank] = 0xffffffff;
+
+	return bindcall5(binding.gpio_capture, masks[0], masks[1], words, len,
+	    rate);
+}
 
-		event_pins[gpiopin] = pincb;
-		event_mask |= (1 << gpiopin);
+rpio.prototype.capture = function(words, channels, samples, rate)
+{
+	var masks = [0x0, 0x0];
+	var port, gpiopin, width;
 
-		if (!(event_running))
-			event_running = setInterval(event_poll, 1);
+	/*
+	 * A numeric channel list is a raw GPIO0 - GPIO31 mask, otherwise
+	 * build a mask for each bank from the array of pins.
+	 */
+	if (!Array.isArray(channels)) {
+		masks[0] = channels >>> 0;
 	} else {
-		if (!(gpiopin in event_pins))
-			throw new Error('Pin ' + pin + ' is not listening for events.');
+		port = pins_to_port(channels);
+		for (var i = 0; i < port.gpiopins.length; i++) {
+			gpiopin = port.gpiopins[i];
+			masks[gpiopin >> 5] =
+			    (masks[gpiopin >> 5] | (1 << (gpiopin & 31))) >>> 0;
+		}
+	}
 
-		bindcall(binding.gpio_event_clear, gpiopin);
+	width = (masks[0] ? 1 : 0) + (masks[1] ? 1 : 0);
+	if (width === 0)
+		throw new Error('No channels selected for capture');
 
-		module.exports.removeListener('pin' + gpiopin, event_pins[gpiopin]);
+	if (samples === undefined)
+		samples = Math.floor(words.length / width);
 
-		delete event_pins[gpiopin];
-		event_mask &= ~(1 << gpiopin);
+	if (samples * width > words.length)
+		throw new Error('Array not large enough to accommodate request');
 
-		if (Object.keys(event_pins).length === 0) {
-			clearInterval(event_running);
-			event_running = false;
-		}
-	}
+	return bindcall5(binding.gpio_capture, masks[0], masks[1], words,
+	    samples, rate || 0);
 }
 
-rpio.prototype.close = function(pin, reset)
+rpio.prototype.captureTrigger = function(words, stamps, pre, triggers, timeout)
 {
-	var gpiopin = pin_to_gpio(pin);
-
-	if (rpio_options.mock)
-		mockmap[pin_to_gpio(pin)] = undefined
+	var trig = new Uint32Array(triggers.length * 3);
+	var bank = null;
+	var port, mask, value, tbank, gpiopin;
 
-	if (reset === undefined)
-		reset = rpio.prototype.PIN_RESET;
+	if (triggers.length === 0)
+		throw new Error('No trigger specified');
 
-	if (gpiopin in event_pins)
-		rpio.prototype.poll(pin, null);
+	if (pre >= Math.min(words.length, stamps.length))
+		throw new Error('Arrays not large enough to accommodate request');
 
-	if (reset) {
-		if (!rpio_options.gpiomem)
-			rpio.prototype.pud(pin, rpio.prototype.PULL_OFF);
-		rpio.prototype.mode(pin, rpio.prototype.INPUT);
+	/*
+	 * Translate each trigger into a raw mask/value pair.  Triggers which
+	 * specify pins set bit n of value for pins[n], otherwise mask and
+	 * value are raw GPIO0 - GPIO31 bits.
+	 */
+	for (var i = 0; i < triggers.length; i++) {
+		if (triggers[i].pins === undefined) {
+			mask = triggers[i].mask >>> 0;
+			value = triggers[i].value >>> 0;
+			tbank = 0;
+		} else {
+			port = pins_to_port(triggers[i].pins);
+			mask = value = 0;
+			tbank = port.gpiopins.length ? port.gpiopins[0] >> 5 : 0;
+			for (var j = 0; j < port.gpiopins.length; j++) {
+				gpiopin = port.gpiopins[j];
+				if ((gpiopin >> 5) !== tbank)
+					throw new Error('Trigger pins must be in the same GPIO bank');
+				mask |= (1 << (gpiopin & 31));
+				if (triggers[i].value & (1 << j))
+					value |= (1 << (gpiopin & 31));
+			}
+		}
+		if (bank !== null && bank !== tbank)
+			throw new Error('Trigger pins must be in the same GPIO bank');
+		bank = tbank;
+		trig[i * 3] = mask;
+		trig[i * 3 + 1] = value;
+		trig[i * 3 + 2] = triggers[i].edge ? 1 : 0;
 	}
-}
 
-rpio.prototype.exit = function()
-{
-	bindcall(binding.rpio_close);
+	return bindcall6(binding.gpio_capture_trigger, bank, trig, words,
+	    stamps, pre, timeout);
 }
 
-/*
- * PWM
- */
-rpio.prototype.pwmSetClockDivider = function(divider)
+rpio.prototype.readbufPacked = function(pin, buf, samples, mode)
 {
-	if (divider !== 0 && (divider & (divider - 1)) !== 0)
-		throw new Error('Clock divider must be zero or power of two');
+	if (samples === undefined)
+		samples = buf.length * 8;
 
-	return bindcall(binding.pwm_set_clock, divider);
-}
+	if (Math.ceil(samples / 8) > buf.length)
+		throw new Error('Buffer not large enough to accommodate request');
 
-rpio.prototype.pwmSetRange = function(pin, range)
-{
-	var channel = get_pwm_channel(pin);
+	/* In mock mode every sample is the pin's current level. */
+	if (rpio_options.mock) {
+		var level = rpio.prototype.read(pin) ? 0xff : 0x00;
+		buf.fill(level, 0, samples >> 3);
+		if (samples & 7)
+			buf[samples >> 3] = (level << (8 - (samples & 7))) & 0xff;
+		return;
+	}
 
-	return bindcall2(binding.pwm_set_range, channel, range);
+	return bindcall4(binding.gpio_readbuf_packed, pin_to_gpio(pin), buf,
+	    samples, mode ? 1 : 0);
 }
 
-rpio.prototype.pwmSetData = function(pin, data)
+rpio.prototype.readPort = function(pins)
 {
-	var channel = get_pwm_channel(pin);
+	var port, words, value;
+
+	if (pins === undefined)
+		pins = rpio.prototype.PORT_BANK0;
+
+	if (!Array.isArray(pins)) {
+		if (pins !== rpio.prototype.PORT_ALL)
+			return read_port(pins);
+		if (typeof BigInt === 'undefined')
+			throw new Error('PORT_ALL requires BigInt support');
+		if (rpio_options.mock) {
+			return BigInt(mock_read_port(1)) * BigInt(0x100000000)
+			     + BigInt(mock_read_port(0));
+		}
+		return bindcall(binding.gpio_read_port, pins);
+	}
 
-	return bindcall2(binding.pwm_set_data, channel, data);
-}
+	port = pins_to_port(pins);
+	words = [
+		port.banks[0] ? read_port(0) : 0,
+		port.banks[1] ? read_port(1) : 0
+	];
 
-/*
- * i2c
- */
-rpio.prototype.i2cBegin = function()
-{
-	if (!rpio_inited) {
-		/* i2c requires full /dev/mem */
-		rpio_options.gpiomem = false;
-		rpio.prototype.init();
+	value = 0;
+	for (var i = 0; i < port.gpiopins.length; i++) {
+		if (words[port.gpiopins[i] >> 5] & (1 << (port.gpiopins[i] & 31)))
+			value |= (1 << i);
 	}
 
-	if (rpio_options.gpiomem)
-		throw new Error('i2c not available in gpiomem mode');
-
-	bindcall(binding.i2c_begin);
+	return value >>> 0;
 }
 
-rpio.prototype.i2cSetSlaveAddress = function(addr)
+rpio.prototype.write = function(pin, value)
 {
-	return bindcall(binding.i2c_set_slave_address, addr);
+	if (rpio_options.mock) {
+		mock_edge(pin_to_gpio(pin), value);
+		return mockmap[pin_to_gpio(pin)] = value
+	}
+
+	return bindcall2(binding.gpio_write, pin_to_gpio(pin), value);
 }
 
-rpio.prototype.i2cSetClockDivider = function(divider)
+rpio.prototype.writeMask = function(values, mask)
 {
-	if ((divider % 2) !== 0)
-		throw new Error('Clock divider must be an even number');
+	var port, gpiopin, bank, bit;
+	var banks = [0x0, 0x0, 0x0, 0x0];
 
-	return bindcall(binding.i2c_set_clock_divider, divider);
-}
+	/*
+	 * A numeric mask is a raw GPIO0 - GPIO31 mask, otherwise translate the
+	 * array of pins into value/mask pairs for each bank.
+	 */
+	if (!Array.isArray(mask)) {
+		banks[0] = values >>> 0;
+		banks[1] = mask >>> 0;
+		for (gpiopin = 0; rpio_options.mock && gpiopin < 32; gpiopin++) {
+			if (banks[1] & (1 << gpiopin))
+				mockmap[gpiopin] = (banks[0] >>> gpiopin) & 1;
+		}
+	} else {
+		port = pins_to_port(mask);
+		for (var i = 0; i < port.gpiopins.length; i++) {
+			gpiopin = port.gpiopins[i];
+			bank = (gpiopin >> 5) * 2;
+			bit = 1 << (gpiopin & 31);
+			banks[bank + 1] = (banks[bank + 1] | bit) >>> 0;
+			if (values & (1 << i))
+				banks[bank] = (banks[bank] | bit) >>> 0;
+			if (rpio_options.mock)
+				mockmap[gpiopin] = (values >>> i) & 1;
+		}
+	}
 
-rpio.prototype.i2cSetBaudRate = function(baud)
-{
-	return bindcall(binding.i2c_set_baudrate, baud);
+	return bindcall4(binding.gpio_write_mask, banks[0], banks[1], banks[2],
+	    banks[3]);
 }
 
-rpio.prototype.i2cRead = function(buf, len)
+rpio.prototype.writebuf = function(pin, buf, len)
 {
 	if (len === undefined)
 		len = buf.length;
@@ -1078,76 +1304,883 @@ rpio.prototype.i2cRead = function(buf, len)
 	if (len > buf.length)
 		throw new Error('Buffer not large enough to accommodate request');
 
-	return bindcall2(binding.i2c_read, buf, len);
+	return bindcall3(binding.gpio_writebuf, pin_to_gpio(pin), buf, len);
 }
 
-rpio.prototype.i2cReadRegisterRestart = function(reg, buf, len)
+rpio.prototype.writeWave = function(pin, buf, timing, len)
 {
+	var durations, period;
+
 	if (len === undefined)
 		len = buf.length;
 
 	if (len > buf.length)
 		throw new Error('Buffer not large enough to accommodate request');
 
-	return bindcall3(binding.i2c_read_register_rs, reg, buf, len);
-}
-
-rpio.prototype.i2cWrite = function(buf, len)
-{
-	if (len === undefined)
-		len = buf.length;
+	/*
+	 * Timing is either a fixed step period, or an array of per-step
+	 * durations, both in microseconds.
+	 */
+	if (typeof(timing) === 'number') {
+		durations = new Uint32Array(0);
+		period = timing;
+	} else {
+		if (timing.length < len)
+			throw new Error('Not enough durations to accommodate request');
+		durations = (timing instanceof Uint32Array) ? timing
+		    : new Uint32Array(timing);
+		period = 0;
+	}
 
-	if (len > buf.length)
-		throw new Error('Buffer not large enough to accommodate request');
+	if (rpio_options.mock && len > 0)
+		mockmap[pin_to_gpio(pin)] = buf[len - 1];
 
-	return bindcall2(binding.i2c_write, buf, len);
+	return bindcall5(binding.gpio_writebuf_timed, pin_to_gpio(pin), buf, len,
+	    durations, period);
 }
 
-rpio.prototype.i2cWriteReadRestart = function(cmdbuf, cmdlen, rbuf, rlen)
+rpio.prototype.writeMaskWave = function(words, mask, period, len)
 {
-	if (cmdlen === undefined)
-		cmdlen = cmdbuf.length;
+	var port, gpiomask, out, word, i, j;
 
-	if (cmdlen > cmdbuf.length)
-		throw new Error('Write buffer not large enough to accommodate request');
+	if (len === undefined)
+		len = words.length;
 
-	if (rlen === undefined)
-		rlen = rbuf.length;
+	if (len > words.length)
+		throw new Error('Array not large enough to accommodate request');
 
-	if (rlen > rbuf.length)
-		throw new Error('Read buffer not large enough to accommodate request');
+	/*
+	 * As with writeMask(), a numeric mask means the words are raw GPIO0 -
+	 * GPIO31 values, otherwise translate each word once up front so that
+	 * bit n drives mask[n].
+	 */
+	if (!Array.isArray(mask)) {
+		gpiomask = mask >>> 0;
+		out = words;
+	} else {
+		port = pins_to_port(mask);
+		if (port.banks[1])
+			throw new Error('Waveform pins must be in GPIO0 - GPIO31');
+		gpiomask = 0;
+		for (j = 0; j < port.gpiopins.length; j++)
+			gpiomask |= (1 << port.gpiopins[j]);
+		gpiomask >>>= 0;
+		out = new Uint32Array(len);
+		for (i = 0; i < len; i++) {
+			word = 0;
+			for (j = 0; j < port.gpiopins.length; j++) {
+				if (words[i] & (1 << j))
+					word |= (1 << port.gpiopins[j]);
+			}
+			out[i] = word;
+		}
+	}
 
-	return bindcall4(binding.i2c_write_read_rs, cmdbuf, cmdlen, rbuf, rlen);
-}
+	if (rpio_options.mock && len > 0)
+		rpio.prototype.writeMask(out[len - 1], gpiomask);
 
-rpio.prototype.i2cEnd = function()
-{
-	bindcall(binding.i2c_end);
+	return bindcall4(binding.gpio_write_mask_timed, out, len, gpiomask,
+	    period);
 }
 
 /*
- * SPI
+ * Streaming output.  Chunks are copied into a native ring as space allows,
+ * and a chunk's write callback is held back until all of it has been
+ * accepted, which is what provides backpressure to the writer.  The native
+ * side calls stream_notify when the ring has drained to half full, and again
+ * once an ended stream has been played out.  Each kind of stream has its own
+ * set of bindings and may only have one stream open at a time.
  */
-rpio.prototype.spiBegin = function()
+var stream_states = {};
+
+function stream_flush(state)
 {
-	if (!rpio_inited) {
-		/* SPI requires full /dev/mem */
-		rpio_options.gpiomem = false;
-		rpio.prototype.init();
-	}
+	var p = state.pending;
 
-	if (rpio_options.gpiomem)
-		throw new Error('SPI not available in gpiomem mode');
+	p.offset += bindcall3(state.native.write, p.chunk, p.offset,
+	    p.chunk.length);
+	if (p.offset < p.chunk.length)
+		return;
 
-	bindcall(binding.spi_begin);
+	state.pending = null;
+	p.cb();
 }
 
-rpio.prototype.spiChipSelect = function(cs)
+function stream_notify(state, finished, underruns)
 {
-	return bindcall(binding.spi_chip_select, cs);
-}
+	if (stream_states[state.kind] !== state)
+		return;
 
-rpio.prototype.spiSetCSPolarity = function(cs, active)
+	state.stream.underruns = underruns;
+
+	if (finished) {
+		delete stream_states[state.kind];
+		bindcall(state.native.close);
+		state.final();
+	} else if (state.pending) {
+		stream_flush(state);
+	}
+}
+
+/*
+ * Return a Writable for a new stream of the given kind.  "open" is called
+ * with the notify callback to open the native stream, and in mock mode
+ * "mock" is called with each chunk instead.
+ */
+function stream_create(kind, native, open, mock)
+{
+	var ws, state;
+
+	if (stream_states[kind])
+		throw new Error('A stream is already open');
+
+	ws = new Writable({highWaterMark: 65536});
+	ws.underruns = 0;
+	state = {kind: kind, native: native, stream: ws, pending: null,
+	    final: null};
+
+	ws._write = function(chunk, encoding, cb) {
+		if (rpio_options.mock) {
+			mock(chunk);
+			return cb();
+		}
+		state.pending = {chunk: chunk, offset: 0, cb: cb};
+		stream_flush(state);
+	};
+
+	ws._final = function(cb) {
+		if (rpio_options.mock) {
+			delete stream_states[kind];
+			return cb();
+		}
+		state.final = cb;
+		bindcall(native.end);
+	};
+
+	ws._destroy = function(err, cb) {
+		if (stream_states[kind] === state) {
+			delete stream_states[kind];
+			bindcall(native.close);
+		}
+		cb(err);
+	};
+
+	open(function(finished, underruns) {
+		stream_notify(state, finished, underruns);
+	});
+	stream_states[kind] = state;
+
+	return ws;
+}
+
+rpio.prototype.createWriteStream = function(pins, rate)
+{
+	var port, gpios;
+
+	if (stream_states.gpio)
+		throw new Error('A stream is already open');
+
+	if (pins.length < 1 || pins.length > 8)
+		throw new Error('Streams support 1 to 8 pins');
+
+	port = pins_to_port(pins);
+	if (port.banks[0] && port.banks[1])
+		throw new Error('Stream pins must all be in the same bank');
+
+	gpios = new Uint32Array(port.gpiopins.length);
+	for (var i = 0; i < gpios.length; i++)
+		gpios[i] = port.gpiopins[i] & 31;
+
+	return stream_create('gpio', {
+		write: binding.gpio_stream_write,
+		end: binding.gpio_stream_end,
+		close: binding.gpio_stream_close
+	}, function(notify) {
+		bindcall4(binding.gpio_stream_open, port.banks[1] ? 1 : 0,
+		    gpios, rate, notify);
+	}, function(chunk) {
+		for (var j = 0; j < port.gpiopins.length; j++)
+			mockmap[port.gpiopins[j]] =
+			    (chunk[chunk.length - 1] >> j) & 1;
+	});
+}
+
+rpio.prototype.readpad = function(group)
+{
+	if (rpio_options.gpiomem)
+		throw new Error('Pad control not available in gpiomem mode');
+
+	return bindcall(binding.gpio_pad_read, group);
+}
+
+rpio.prototype.writepad = function(group, control)
+{
+	if (rpio_options.gpiomem)
+		throw new Error('Pad control not available in gpiomem mode');
+
+	bindcall2(binding.gpio_pad_write, group, control);
+}
+
+rpio.prototype.pud = function(pin, state)
+{
+	bindcall2(binding.gpio_pud, pin_to_gpio(pin), state);
+}
+
+rpio.prototype.poll = function(pin, cb, direction)
+{
+	var gpiopin = pin_to_gpio(pin);
+
+	if (direction === undefined)
+		direction = rpio.prototype.POLL_BOTH;
+
+	/*
+	 * If callback is a function, set up pin for polling, otherwise
+	 * clear it.
+	 */
+	if (typeof(cb) === 'function') {
+		if (gpiopin in event_pins)
+			throw new Error('Pin ' + pin + ' is already listening for events.');
+
+		if (gpiopin in edge_waiting)
+			throw new Error('Pin ' + pin + ' is already waiting for an edge.');
+
+		if (gpiopin > 53)
+			throw new Error('Pin ' + pin + ' does not support event detection');
+
+		bindcall2(binding.gpio_event_set, gpiopin, direction);
+
+		event_pins[gpiopin] = {pin: pin, cb: cb, direction: direction};
+		event_gpiopins[gpiopin] = pin;
+		event_mask[gpiopin >> 5] =
+		    (event_mask[gpiopin >> 5] | (1 << (gpiopin & 31))) >>> 0;
+		bindcall2(binding.gpio_event_mask, event_mask[0], event_mask[1]);
+
+		if (!(event_running)) {
+			bindcall2(binding.gpio_event_start,
+			    rpio_options.poll_period, event_poll);
+			event_running = true;
+		}
+	} else {
+		if (!(gpiopin in event_pins))
+			throw new Error('Pin ' + pin + ' is not listening for events.');
+
+		bindcall(binding.gpio_event_clear, gpiopin);
+
+		delete event_pins[gpiopin];
+		event_mask[gpiopin >> 5] =
+		    (event_mask[gpiopin >> 5] & ~(1 << (gpiopin & 31))) >>> 0;
+		bindcall2(binding.gpio_event_mask, event_mask[0], event_mask[1]);
+
+		if (Object.keys(event_pins).length === 0) {
+			bindcall(binding.gpio_event_stop);
+			event_running = false;
+		}
+	}
+}
+
+/*
+ * Waiting for a single edge.  The native side drives the edge detect
+ * registers directly, so the pin must not be polled at the same time, and
+ * only one wait per pin can be outstanding.
+ */
+var edge_waiting = {};
+
+function edge_check(pin, gpiopin)
+{
+	if (gpiopin > 53)
+		throw new Error('Pin ' + pin + ' does not support event detection');
+
+	if (gpiopin in event_pins)
+		throw new Error('Pin ' + pin + ' is already listening for events.');
+
+	if (gpiopin in edge_waiting)
+		throw new Error('Pin ' + pin + ' is already waiting for an edge.');
+}
+
+rpio.prototype.waitForEdge = function(pin, edge, timeout)
+{
+	var gpiopin = pin_to_gpio(pin);
+
+	edge_check(pin, gpiopin);
+
+	if (rpio_options.mock)
+		return -1;
+
+	return bindcall3(binding.gpio_wait_edge, gpiopin, edge, timeout);
+}
+
+rpio.prototype.waitForEdgeAsync = function(pin, edge, timeout, cb)
+{
+	var gpiopin = pin_to_gpio(pin);
+
+	if (typeof(cb) !== 'function') {
+		return new Promise(function(resolve, reject) {
+			rpio.prototype.waitForEdgeAsync(pin, edge, timeout,
+			    function(err, usecs) {
+				if (err)
+					return reject(err);
+				resolve(usecs);
+			});
+		});
+	}
+
+	edge_check(pin, gpiopin);
+
+	edge_waiting[gpiopin] = true;
+
+	if (rpio_options.mock) {
+		return process.nextTick(function() {
+			delete edge_waiting[gpiopin];
+			cb(null, -1);
+		});
+	}
+
+	bindcall4(binding.gpio_wait_edge_async, gpiopin, edge, timeout,
+	    function(err, usecs) {
+		delete edge_waiting[gpiopin];
+		cb(err, usecs);
+	});
+}
+
+rpio.prototype.close = function(pin, reset)
+{
+	var gpiopin = pin_to_gpio(pin);
+
+	if (rpio_options.mock)
+		mockmap[pin_to_gpio(pin)] = undefined
+
+	if (reset === undefined)
+		reset = rpio.prototype.PIN_RESET;
+
+	if (gpiopin in event_pins)
+		rpio.prototype.poll(pin, null);
+
+	/* Stop any software PWM, which would otherwise keep driving the pin. */
+	if (gpiopin <= 53) {
+		delete servo_pins[gpiopin];
+		bindcall(binding.gpio_softpwm_clear, gpiopin);
+	}
+
+	if (reset) {
+		if (!rpio_options.gpiomem)
+			rpio.prototype.pud(pin, rpio.prototype.PULL_OFF);
+		rpio.prototype.mode(pin, rpio.prototype.INPUT);
+	}
+}
+
+rpio.prototype.exit = function()
+{
+	bindcall(binding.rpio_close);
+
+	/* All native background threads are stopped by rpio_close. */
+	event_running = false;
+	stream_states = {};
+	sched_running = false;
+	for (var id in sched_actions)
+		clearTimeout(sched_actions[id].timer);
+	sched_actions = {};
+	servo_pins = {};
+	ramp_running = false;
+	ramp_cbs = {};
+}
+
+/*
+ * PWM
+ */
+/*
+ * General purpose clocks.  As with PWM, the clock and alternate function
+ * depend on the pin.
+ */
+function get_gpclk(pin)
+{
+	var gpiopin = pin_to_gpio(pin);
+
+	switch (gpiopin) {
+	case 4:
+	case 32:
+	case 34:
+		return {clock: 0, func: 4}; /* BCM2835_GPIO_FSEL_ALT0 */
+	case 5:
+	case 42:
+	case 44:
+		return {clock: 1, func: 4};
+	case 6:
+	case 43:
+		return {clock: 2, func: 4};
+	case 20:
+		return {clock: 0, func: 2}; /* BCM2835_GPIO_FSEL_ALT5 */
+	case 21:
+		return {clock: 1, func: 2};
+	default:
+		throw new Error('Pin ' + pin + ' does not support a clock output');
+	}
+}
+
+rpio.prototype.gpclkStart = function(pin, source, divisor, mash)
+{
+	var gpclk = get_gpclk(pin);
+	var gpiopin = pin_to_gpio(pin);
+	var divi = Math.floor(divisor);
+	var divf = Math.round((divisor - divi) * 4096);
+
+	if (rpio_options.gpiomem)
+		throw new Error('Clocks not available in gpiomem mode');
+
+	switch (source) {
+	case rpio.prototype.GPCLK_SRC_GND:
+	case rpio.prototype.GPCLK_SRC_OSC:
+	case rpio.prototype.GPCLK_SRC_PLLA:
+	case rpio.prototype.GPCLK_SRC_PLLC:
+	case rpio.prototype.GPCLK_SRC_PLLD:
+	case rpio.prototype.GPCLK_SRC_HDMI:
+		break;
+	default:
+		throw new Error('Unsupported clock source ' + source);
+	}
+
+	if (divf === 4096) {
+		divi++;
+		divf = 0;
+	}
+
+	/* A fractional divisor only has an effect with MASH filtering. */
+	if (mash === undefined)
+		mash = divf ? 1 : 0;
+
+	if (!(mash >= 0 && mash <= 3))
+		throw new Error('MASH mode must be between 0 and 3');
+
+	if (!(divi >= [1, 2, 3, 5][mash] && divi <= 4095))
+		throw new Error('Clock divisor out of range for MASH mode ' + mash);
+
+	check_sys_gpio(gpiopin);
+
+	bindcall2(binding.gpio_function, gpiopin, gpclk.func);
+	bindcall5(binding.gpclk_start, gpclk.clock, source, divi, divf, mash);
+}
+
+rpio.prototype.gpclkStop = function(pin)
+{
+	bindcall(binding.gpclk_stop, get_gpclk(pin).clock);
+}
+
+rpio.prototype.pwmSetClockDivider = function(divider)
+{
+	if (divider !== 0 && (divider & (divider - 1)) !== 0)
+		throw new Error('Clock divider must be zero or power of two');
+
+	return bindcall(binding.pwm_set_clock, divider);
+}
+
+rpio.prototype.pwmSetClockDividerAsync = function(divider, cb)
+{
+	if (typeof(cb) !== 'function') {
+		return new Promise(function(resolve, reject) {
+			rpio.prototype.pwmSetClockDividerAsync(divider,
+			    function(err) {
+				if (err)
+					return reject(err);
+				resolve();
+			});
+		});
+	}
+
+	if (divider !== 0 && (divider & (divider - 1)) !== 0)
+		throw new Error('Clock divider must be zero or power of two');
+
+	if (rpio_options.mock)
+		return process.nextTick(cb, null);
+
+	bindcall2(binding.pwm_set_clock_async, divider, cb);
+}
+
+rpio.prototype.pwmSetRange = function(pin, range)
+{
+	var channel = get_pwm_channel(pin);
+
+	return bindcall2(binding.pwm_set_range, channel, range);
+}
+
+rpio.prototype.pwmSetData = function(pin, data)
+{
+	var channel = get_pwm_channel(pin);
+
+	return bindcall2(binding.pwm_set_data, channel, data);
+}
+
+/*
+ * Update both channels together.  The data values are passed in channel
+ * order, and the channel 0 pin is used to wait for the start of a period.
+ */
+rpio.prototype.pwmSetDataPair = function(pin0, data0, pin1, data1, timeout)
+{
+	var data = [];
+	var syncpin = 0xff;
+
+	data[get_pwm_channel(pin0)] = data0;
+	data[get_pwm_channel(pin1)] = data1;
+
+	if (data[0] === undefined || data[1] === undefined)
+		throw new Error('Pins must be on different PWM channels');
+
+	if (timeout !== undefined)
+		syncpin = pin_to_gpio(get_pwm_channel(pin0) === 0 ? pin0 : pin1);
+	else
+		timeout = 0;
+
+	return bindcall4(binding.pwm_set_data_pair, data[0], data[1], syncpin,
+	    timeout);
+}
+
+/*
+ * PWM planner.  Settings for up to one pin per channel are packed into the
+ * [frequency, duty, resolution] * 2 + tolerance layout used by
+ * pwm_configure, which returns the chosen divisor and fills in the range,
+ * data, and actual frequency for each channel.
+ */
+function pwm_plan(settings, tolerance, apply)
+{
+	var params = new Float64Array(7);
+	var out = new Float64Array(6);
+	var channels = [];
+	var plan, setting, channel, duty, resolution, divisor;
+
+	if (tolerance === undefined)
+		tolerance = 0.01;
+
+	if (!settings.length)
+		throw new Error('At least one PWM pin must be given');
+
+	for (var i = 0; i < settings.length; i++) {
+		setting = settings[i];
+		channel = get_pwm_channel(setting.pin);
+		if (params[channel * 3])
+			throw new Error('Pin ' + setting.pin +
+			    ' shares a PWM channel with another pin');
+		if (!(setting.frequency > 0))
+			throw new Error('Frequency must be greater than 0');
+		duty = (setting.duty === undefined) ? 0 : setting.duty;
+		if (!(duty >= 0 && duty <= 1))
+			throw new Error('Duty cycle must be between 0 and 1');
+		resolution = (setting.resolution === undefined) ? 1
+		    : setting.resolution;
+		if (!(resolution >= 1))
+			throw new Error('Resolution must be at least 1');
+		params[channel * 3] = setting.frequency;
+		params[channel * 3 + 1] = duty;
+		params[channel * 3 + 2] = resolution;
+		channels.push(channel);
+	}
+	params[6] = tolerance;
+
+	divisor = bindcall3(binding.pwm_configure, params, out, apply ? 1 : 0);
+	if (divisor === undefined)
+		return null;
+	if (divisor === 0)
+		throw new Error('No clock divisor meets the requested resolution');
+
+	plan = {divisor: divisor, channels: []};
+	for (i = 0; i < settings.length; i++) {
+		channel = channels[i];
+		plan.channels.push({
+			pin: settings[i].pin,
+			range: out[channel * 3],
+			data: out[channel * 3 + 1],
+			frequency: out[channel * 3 + 2]
+		});
+	}
+
+	return plan;
+}
+
+rpio.prototype.pwmPlan = function(settings, tolerance)
+{
+	return pwm_plan(settings, tolerance, false);
+}
+
+rpio.prototype.pwmConfigure = function(settings, tolerance)
+{
+	return pwm_plan(settings, tolerance, true);
+}
+
+/*
+ * PWM ramps.  As with the scheduler, each ramp is given an id so that a
+ * completion can be matched to its callback, and a ramp which has been
+ * replaced or cancelled does not run the callback of its successor.
+ */
+var ramp_ids = [0, 0];
+var ramp_cbs = {};
+var ramp_nextid = 1;
+var ramp_running = false;
+
+function ramp_deliver(done)
+{
+	var cb;
+
+	for (var i = 0; i < done.length; i++) {
+		cb = ramp_cbs[done[i]];
+		delete ramp_cbs[done[i]];
+		if (cb)
+			cb();
+	}
+}
+
+rpio.prototype.pwmRamp = function(pin, from, to, duration, curve, cb)
+{
+	var channel = get_pwm_channel(pin);
+	var id;
+
+	if (typeof(curve) === 'function') {
+		cb = curve;
+		curve = undefined;
+	}
+
+	if (curve === undefined)
+		curve = rpio.prototype.EASE_LINEAR;
+
+	id = ramp_nextid;
+	ramp_nextid = (ramp_nextid + 1) >>> 0 || 1;
+
+	delete ramp_cbs[ramp_ids[channel]];
+	ramp_ids[channel] = id;
+	if (cb)
+		ramp_cbs[id] = cb;
+
+	if (rpio_options.mock) {
+		setTimeout(ramp_deliver, duration, [id]);
+		return;
+	}
+
+	if (!ramp_running) {
+		bindcall(binding.pwm_ramp_start, ramp_deliver);
+		ramp_running = true;
+	}
+
+	bindcall6(binding.pwm_ramp, channel, id, from, to,
+	    Math.round(duration * 1000), curve);
+}
+
+rpio.prototype.pwmRampCancel = function(pin)
+{
+	var channel = get_pwm_channel(pin);
+
+	delete ramp_cbs[ramp_ids[channel]];
+
+	return !!bindcall(binding.pwm_ramp_cancel, channel);
+}
+
+rpio.prototype.createPwmStream = function(pin, serial)
+{
+	var channel = get_pwm_channel(pin);
+
+	return stream_create('pwm', {
+		write: binding.pwm_stream_write,
+		end: binding.pwm_stream_end,
+		close: binding.pwm_stream_close
+	}, function(notify) {
+		bindcall3(binding.pwm_stream_open, channel, serial ? 1 : 0,
+		    notify);
+	}, function() {});
+}
+
+/*
+ * Software PWM, on any output pin.  Frequency and duty cycle are converted to
+ * a period and high time in whole microseconds for the native engine.
+ */
+rpio.prototype.softPwm = function(pin, frequency, duty)
+{
+	var gpiopin = pin_to_gpio(pin);
+	var period;
+
+	if (gpiopin > 53)
+		throw new Error('Pin ' + pin + ' does not support software PWM');
+
+	if (!(frequency > 0 && frequency <= 100000))
+		throw new Error('Frequency must be between 0 and 100kHz');
+
+	if (!(duty >= 0 && duty <= 1))
+		throw new Error('Duty cycle must be between 0 and 1');
+
+	period = Math.round(1000000 / frequency);
+
+	if (rpio_options.mock && (duty === 0 || duty === 1))
+		mockmap[gpiopin] = duty;
+
+	return bindcall3(binding.gpio_softpwm_set, gpiopin, period,
+	    Math.round(period * duty));
+}
+
+rpio.prototype.softPwmStop = function(pin)
+{
+	var gpiopin = pin_to_gpio(pin);
+
+	if (rpio_options.mock)
+		mockmap[gpiopin] = 0;
+
+	delete servo_pins[gpiopin];
+
+	return bindcall(binding.gpio_softpwm_clear, gpiopin);
+}
+
+/*
+ * Servos are software PWM channels with a fixed 20ms period, so they all
+ * start each pulse together in a single SET write and end them in order of
+ * pulse width, sharing CLR writes where widths are within a few usecs.
+ */
+var servo_pins = {};
+
+rpio.prototype.servo = function(pin, pulse)
+{
+	var gpiopin = pin_to_gpio(pin);
+
+	if (gpiopin > 53)
+		throw new Error('Pin ' + pin + ' does not support servo output');
+
+	if (!(pulse >= 500 && pulse <= 2500))
+		throw new Error('Servo pulse must be between 500 and 2500us');
+
+	if (!(gpiopin in servo_pins) && Object.keys(servo_pins).length >= 16)
+		throw new Error('No more than 16 servos are supported');
+
+	servo_pins[gpiopin] = true;
+
+	return bindcall3(binding.gpio_softpwm_set, gpiopin, 20000,
+	    Math.round(pulse));
+}
+
+rpio.prototype.servoStop = function(pin)
+{
+	var gpiopin = pin_to_gpio(pin);
+
+	if (!(gpiopin in servo_pins))
+		throw new Error('Pin ' + pin + ' is not driving a servo');
+
+	return rpio.prototype.softPwmStop(pin);
+}
+
+rpio.prototype.softPwmJitter = function()
+{
+	var stats = bindcall(binding.gpio_softpwm_stats);
+
+	if (!stats)
+		return {edges: 0, max: 0, mean: 0};
+
+	return {edges: stats[0], max: stats[1], mean: stats[2]};
+}
+
+/*
+ * i2c
+ */
+rpio.prototype.i2cBegin = function()
+{
+	if (!rpio_inited) {
+		/* i2c requires full /dev/mem */
+		rpio_options.gpiomem = false;
+		rpio.prototype.init();
+	}
+
+	if (rpio_options.gpiomem)
+		throw new Error('i2c not available in gpiomem mode');
+
+	bindcall(binding.i2c_begin);
+}
+
+rpio.prototype.i2cSetSlaveAddress = function(addr)
+{
+	return bindcall(binding.i2c_set_slave_address, addr);
+}
+
+rpio.prototype.i2cSetClockDivider = function(divider)
+{
+	if ((divider % 2) !== 0)
+		throw new Error('Clock divider must be an even number');
+
+	return bindcall(binding.i2c_set_clock_divider, divider);
+}
+
+rpio.prototype.i2cSetBaudRate = function(baud)
+{
+	return bindcall(binding.i2c_set_baudrate, baud);
+}
+
+rpio.prototype.i2cRead = function(buf, len)
+{
+	if (len === undefined)
+		len = buf.length;
+
+	if (len > buf.length)
+		throw new Error('Buffer not large enough to accommodate request');
+
+	return bindcall2(binding.i2c_read, buf, len);
+}
+
+rpio.prototype.i2cReadRegisterRestart = function(reg, buf, len)
+{
+	if (len === undefined)
+		len = buf.length;
+
+	if (len > buf.length)
+		throw new Error('Buffer not large enough to accommodate request');
+
+	return bindcall3(binding.i2c_read_register_rs, reg, buf, len);
+}
+
+rpio.prototype.i2cWrite = function(buf, len)
+{
+	if (len === undefined)
+		len = buf.length;
+
+	if (len > buf.length)
+		throw new Error('Buffer not large enough to accommodate request');
+
+	return bindcall2(binding.i2c_write, buf, len);
+}
+
+rpio.prototype.i2cWriteReadRestart = function(cmdbuf, cmdlen, rbuf, rlen)
+{
+	if (cmdlen === undefined)
+		cmdlen = cmdbuf.length;
+
+	if (cmdlen > cmdbuf.length)
+		throw new Error('Write buffer not large enough to accommodate request');
+
+	if (rlen === undefined)
+		rlen = rbuf.length;
+
+	if (rlen > rbuf.length)
+		throw new Error('Read buffer not large enough to accommodate request');
+
+	return bindcall4(binding.i2c_write_read_rs, cmdbuf, cmdlen, rbuf, rlen);
+}
+
+rpio.prototype.i2cEnd = function()
+{
+	bindcall(binding.i2c_end);
+}
+
+/*
+ * SPI
+ */
+rpio.prototype.spiBegin = function()
+{
+	if (!rpio_inited) {
+		/* SPI requires full /dev/mem */
+		rpio_options.gpiomem = false;
+		rpio.prototype.init();
+	}
+
+	if (rpio_options.gpiomem)
+		throw new Error('SPI not available in gpiomem mode');
+
+	bindcall(binding.spi_begin);
+}
+
+rpio.prototype.spiChipSelect = function(cs)
+{
+	return bindcall(binding.spi_chip_select, cs);
+}
+
+rpio.prototype.spiSetCSPolarity = function(cs, active)
 {
 	return bindcall2(binding.spi_set_cs_polarity, cs, active);
 }
@@ -1180,6 +2213,344 @@ rpio.prototype.spiEnd = function()
 	bindcall(binding.spi_end);
 }
 
+/*
+ * Deadline scheduler.  Actions are given an id and queued natively, and the
+ * callback and any capture array are kept here until the scheduler thread
+ * reports the action as done, which also keeps the array from being garbage
+ * collected while the thread may still write to it.  In mock mode actions
+ * are simply run from a timer.
+ */
+var sched_actions = {};
+var sched_nextid = 1;
+var sched_running = false;
+
+function sched_deliver(done)
+{
+	var action;
+
+	for (var i = 0; i < done.length; i += 2) {
+		action = sched_actions[done[i]];
+		if (!action)
+			continue;
+		delete sched_actions[done[i]];
+		if (action.cb)
+			action.cb(done[i + 1]);
+	}
+}
+
+function sched_id()
+{
+	var id = sched_nextid;
+
+	sched_nextid = (sched_nextid + 1) >>> 0 || 1;
+
+	if (!sched_running) {
+		bindcall(binding.gpio_sched_start, sched_deliver);
+		sched_running = true;
+	}
+
+	return id;
+}
+
+function sched_mock(id, when, fn)
+{
+	var delay = Math.max(0, (when - rpio.prototype.now()) / 1000);
+
+	sched_actions[id].timer = setTimeout(function() {
+		fn();
+		sched_deliver([id, 0]);
+	}, delay);
+}
+
+/*
+ * Convert values and an array of pins, or a raw GPIO0 - GPIO31 mask, into a
+ * single bank value/mask pair.
+ */
+function sched_port(values, mask)
+{
+	var port, bank, word = 0, bits = 0;
+
+	if (!Array.isArray(mask))
+		return {bank: 0, value: values >>> 0, mask: mask >>> 0};
+
+	port = pins_to_port(mask);
+	if (port.banks[0] && port.banks[1])
+		throw new Error('Scheduled pins must all be in the same bank');
+	bank = port.banks[1] ? 1 : 0;
+
+	for (var i = 0; i < port.gpiopins.length; i++) {
+		bits |= (1 << (port.gpiopins[i] & 31));
+		if (values & (1 << i))
+			word |= (1 << (port.gpiopins[i] & 31));
+	}
+
+	return {bank: bank, value: word >>> 0, mask: bits >>> 0};
+}
+
+function sched_write(when, toggle, values, mask, cb)
+{
+	var port = sched_port(values, mask);
+	var id = sched_id();
+
+	if (rpio_options.mock) {
+		sched_actions[id] = {cb: cb};
+		sched_mock(id, when, function() {
+			var word = toggle ? ~mock_read_port(port.bank) : port.value;
+			for (var i = 0; i < 32; i++) {
+				if (port.mask & (1 << i))
+					mockmap[port.bank * 32 + i] = (word >>> i) & 1;
+			}
+		});
+		return id;
+	}
+
+	/*
+	 * Only register the action once it has been queued, so that nothing
+	 * is left behind if the native side throws.
+	 */
+	bindcall6(binding.gpio_sched_write, id, when, toggle ? 1 : 0,
+	    port.bank, port.value, port.mask);
+	sched_actions[id] = {cb: cb};
+
+	return id;
+}
+
+rpio.prototype.now = function()
+{
+	if (rpio_options.mock) {
+		var t = process.hrtime();
+		return t[0] * 1000000 + Math.floor(t[1] / 1000);
+	}
+
+	return bindcall(binding.rpio_now);
+}
+
+rpio.prototype.scheduleWrite = function(when, values, mask, cb)
+{
+	return sched_write(when, false, values, mask, cb);
+}
+
+rpio.prototype.scheduleToggle = function(when, mask, cb)
+{
+	return sched_write(when, true, 0, mask, cb);
+}
+
+rpio.prototype.scheduleCapture = function(when, bank, words, rate, cb)
+{
+	var id;
+
+	if (bank !== rpio.prototype.PORT_BANK0 &&
+	    bank !== rpio.prototype.PORT_BANK1)
+		throw new Error('Invalid bank ' + bank);
+
+	if (!(words instanceof Uint32Array))
+		throw new Error('Capture array must be a Uint32Array');
+
+	if (!(rate >= 1 && rate <= 1000000))
+		throw new Error('Sample rate must be 1Hz - 1MHz');
+
+	id = sched_id();
+
+	if (rpio_options.mock) {
+		sched_actions[id] = {cb: cb, words: words};
+		sched_mock(id, when, function() {
+			words.fill(mock_read_port(bank));
+		});
+		return id;
+	}
+
+	bindcall6(binding.gpio_sched_capture, id, when, bank, words,
+	    words.length, rate);
+	sched_actions[id] = {cb: cb, words: words};
+
+	return id;
+}
+
+rpio.prototype.cancel = function(id)
+{
+	var action = sched_actions[id];
+
+	if (!action)
+		return false;
+
+	if (rpio_options.mock) {
+		clearTimeout(action.timer);
+	} else if (!bindcall(binding.gpio_sched_cancel, id)) {
+		/* Already running, the completion will clean up. */
+		return false;
+	}
+
+	delete sched_actions[id];
+	return true;
+}
+
+/*
+ * Micro-programs.  Each method appends an instruction, translating pins once
+ * at build time, and returns the program for chaining.  Opcodes must match
+ * the PROG_* definitions in src/rpio.cc.
+ */
+var PROG_WRITE = 0x1;
+var PROG_WRITE_MASK = 0x2;
+var PROG_READ = 0x3;
+var PROG_DELAY = 0x4;
+var PROG_WAIT = 0x5;
+var PROG_SPI = 0x6;
+var PROG_I2C_ADDR = 0x7;
+var PROG_I2C_WRITE = 0x8;
+var PROG_I2C_READ = 0x9;
+
+function rpio_program()
+{
+	this.ops = [];
+	this.slots = 0;
+	this.code = null;
+}
+
+rpio_program.prototype.emit = function(ops)
+{
+	for (var i = 0; i < ops.length; i++)
+		this.ops.push(ops[i] >>> 0);
+	this.code = null;
+
+	return this;
+}
+
+rpio_program.prototype.write = function(pin, value)
+{
+	return this.emit([PROG_WRITE, pin_to_gpio(pin), value ? 1 : 0]);
+}
+
+rpio_program.prototype.writeMask = function(values, mask)
+{
+	var port, gpiopin, bank, bit;
+	var banks = [0x0, 0x0, 0x0, 0x0];
+
+	if (!Array.isArray(mask))
+		return this.emit([PROG_WRITE_MASK, 0, values, mask]);
+
+	port = pins_to_port(mask);
+	for (var i = 0; i < port.gpiopins.length; i++) {
+		gpiopin = port.gpiopins[i];
+		bank = (gpiopin >> 5) * 2;
+		bit = 1 << (gpiopin & 31);
+		banks[bank + 1] |= bit;
+		if (values & (1 << i))
+			banks[bank] |= bit;
+	}
+
+	if (port.banks[0])
+		this.emit([PROG_WRITE_MASK, 0, banks[0], banks[1]]);
+	if (port.banks[1])
+		this.emit([PROG_WRITE_MASK, 1, banks[2], banks[3]]);
+
+	return this;
+}
+
+rpio_program.prototype.read = function(pin)
+{
+	return this.emit([PROG_READ, pin_to_gpio(pin), this.slots++]);
+}
+
+rpio_program.prototype.usleep = function(usecs)
+{
+	return this.emit([PROG_DELAY, usecs]);
+}
+
+rpio_program.prototype.wait = function(pin, level, timeout)
+{
+	return this.emit([PROG_WAIT, pin_to_gpio(pin), level ? 1 : 0, timeout,
+	    this.slots++]);
+}
+
+rpio_program.prototype.spiTransfer = function(offset, len)
+{
+	return this.emit([PROG_SPI, offset, len]);
+}
+
+rpio_program.prototype.i2cSetSlaveAddress = function(addr)
+{
+	return this.emit([PROG_I2C_ADDR, addr]);
+}
+
+rpio_program.prototype.i2cWrite = function(offset, len)
+{
+	return this.emit([PROG_I2C_WRITE, offset, len, this.slots++]);
+}
+
+rpio_program.prototype.i2cRead = function(offset, len)
+{
+	return this.emit([PROG_I2C_READ, offset, len, this.slots++]);
+}
+
+/*
+ * Only writes and reads are simulated in mock mode, everything else leaves
+ * its slot as 0.
+ */
+function mock_run(ops, results)
+{
+	var pc = 0;
+	var bank;
+
+	while (pc < ops.length) {
+		switch (ops[pc]) {
+		case PROG_WRITE:
+			mockmap[ops[pc + 1]] = ops[pc + 2];
+			pc += 3;
+			break;
+		case PROG_WRITE_MASK:
+			bank = ops[pc + 1] * 32;
+			for (var i = 0; i < 32; i++) {
+				if (ops[pc + 3] & (1 << i))
+					mockmap[bank + i] = (ops[pc + 2] >>> i) & 1;
+			}
+			pc += 4;
+			break;
+		case PROG_READ:
+			results[ops[pc + 2]] = mockmap[ops[pc + 1]] || 0;
+			pc += 3;
+			break;
+		case PROG_DELAY:
+		case PROG_I2C_ADDR:
+			pc += 2;
+			break;
+		case PROG_SPI:
+			pc += 3;
+			break;
+		case PROG_WAIT:
+			pc += 5;
+			break;
+		case PROG_I2C_WRITE:
+		case PROG_I2C_READ:
+			pc += 4;
+			break;
+		}
+	}
+}
+
+rpio.prototype.program = function()
+{
+	return new rpio_program();
+}
+
+rpio.prototype.run = function(prog, data)
+{
+	var results = new Uint32Array(prog.slots);
+
+	if (data === undefined)
+		data = Buffer.alloc(0);
+
+	if (!prog.code)
+		prog.code = new Uint32Array(prog.ops);
+
+	if (rpio_options.mock)
+		mock_run(prog.code, results);
+
+	bindcall5(binding.gpio_run, prog.code, prog.code.length, results, data,
+	    data.length);
+
+	return results;
+}
+
 /*
  * Misc functions.
  */
@@ -369,6 +369,26 @@ void bcm2835_gpio_set_eds_multi(uint32_t mask)
     bcm2835_peri_write(paddr, mask);
 }
 
+/* Read the levels of all 32 pins in a bank, 0 for GPIO 0-31, 1 for 32-53 */
+uint32_t bcm2835_gpio_lev_bank(uint8_t bank)
+{
+    volatile uint32_t* paddr = bcm2835_gpio + BCM2835_GPLEV0/4 + bank;
+    return bcm2835_peri_read(paddr);
+}
+
+uint32_t bcm2835_gpio_eds_bank(uint8_t bank, uint32_t mask)
+{
+    volatile uint32_t* paddr = bcm2835_gpio + BCM2835_GPEDS0/4 + bank;
+    uint32_t value = bcm2835_peri_read(paddr);
+    return (value & mask);
+}
+
+void bcm2835_gpio_set_eds_bank(uint8_t bank, uint32_t mask)
+{
+    volatile uint32_t* paddr = bcm2835_gpio + BCM2835_GPEDS0/4 + bank;
+    bcm2835_peri_write(paddr, mask);
+}
+
 /* Rising edge detect enable */
 void bcm2835_gpio_ren(uint8_t pin)
 {
@@ -597,6 +617,20 @@ void bcm2835_gpio_write_mask(uint32_t value, uint32_t mask)
     bcm2835_gpio_clr_multi((~value) & mask);
 }
 
+/* Same as bcm2835_gpio_write_mask() but for any bank of pins, skipping
+// the SET or CLR store if no pins need to change in that direction.
+*/
+void bcm2835_gpio_write_mask_bank(uint8_t bank, uint32_t value, uint32_t mask)
+{
+    uint32_t set = value & mask;
+    uint32_t clr = (~value) & mask;
+
+    if (set)
+        bcm2835_peri_write(bcm2835_gpio + BCM2835_GPSET0/4 + bank, set);
+    if (clr)
+        bcm2835_peri_write(bcm2835_gpio + BCM2835_GPCLR0/4 + bank, clr);
+}
+
 /* Set the pullup/down resistor for a pin
 //
 // The GPIO Pull-up/down Clock Registers control the actuation of internal pull-downs on
@@ -1686,6 +1720,59 @@ void bcm2835_pwm_set_clock(uint32_t divisor)
     bcm2835_peri_write(bcm2835_clk + BCM2835_PWMCLK_CNTL, BCM2835_PWM_PASSWRD | 0x11); /* Source=osc and enable */
 }
 
+uint32_t bcm2835_pwm_get_clock(void)
+{
+    if (   bcm2835_clk == MAP_FAILED
+        || bcm2835_pwm == MAP_FAILED)
+      return 0; /* bcm2835_init() failed or not root */
+
+    /* Only report a divisor if the clock is enabled and running from the oscillator */
+    if ((bcm2835_peri_read(bcm2835_clk + BCM2835_PWMCLK_CNTL) & 0x1f) != 0x11)
+      return 0;
+    return (bcm2835_peri_read(bcm2835_clk + BCM2835_PWMCLK_DIV) >> 12) & 0xfff;
+}
+
+void bcm2835_gpclk_stop(uint8_t clock)
+{
+    volatile uint32_t* cntl;
+    int i;
+
+    if (bcm2835_clk == MAP_FAILED || clock > 2)
+      return; /* bcm2835_init() failed or not root */
+
+    cntl = bcm2835_clk + BCM2835_GPCLK0_CNTL + clock * 2;
+
+    /* Stop the clock, keeping the source, and wait up to 10ms for it to finish */
+    bcm2835_peri_write(cntl, BCM2835_GPCLK_PASSWRD | (bcm2835_peri_read(cntl) & ~BCM2835_GPCLK_ENAB & 0xffffff));
+    for (i = 0; i < 100 && (bcm2835_peri_read(cntl) & BCM2835_GPCLK_BUSY); i++)
+      bcm2835_delayMicroseconds(100);
+}
+
+void bcm2835_gpclk_start(uint8_t clock, uint8_t source, uint32_t divi, uint32_t divf, uint8_t mash)
+{
+    volatile uint32_t* cntl;
+    uint32_t ctl;
+
+    if (bcm2835_clk == MAP_FAILED || clock > 2)
+      return; /* bcm2835_init() failed or not root */
+
+    cntl = bcm2835_clk + BCM2835_GPCLK0_CNTL + clock * 2;
+
+    /* The divisor and source must not be changed while the clock is busy */
+    bcm2835_gpclk_stop(clock);
+
+    ctl = ((mash & 0x3) << 9) | (source & 0xf);
+    bcm2835_peri_write(cntl + 1, BCM2835_GPCLK_PASSWRD | ((divi & 0xfff) << 12) | (divf & 0xfff));
+    bcm2835_peri_write(cntl, BCM2835_GPCLK_PASSWRD | ctl);
+    bcm2835_peri_write(cntl, BCM2835_GPCLK_PASSWRD | ctl | BCM2835_GPCLK_ENAB);
+}
+
+uint32_t bcm2835_osc_freq(void)
+{
+    /* The oscillator feeding the PWM and GP clocks is 54MHz on the BCM2711 */
+    return pud_type_rpi4 ? 54000000 : 19200000;
+}
+
 void bcm2835_pwm_set_mode(uint8_t channel, uint8_t markspace, uint8_t enabled)
 {
   if (   bcm2835_clk == MAP_FAILED
@@ -1747,6 +1834,70 @@ void bcm2835_pwm_set_data(uint8_t channel, uint32_t data)
       bcm2835_peri_write_nb(bcm2835_pwm + BCM2835_PWM1_DATA, data);
 }
 
+void bcm2835_pwm_set_fifo_mode(uint8_t channel, uint8_t serial, uint8_t enabled)
+{
+  uint32_t bits, control;
+
+  if (   bcm2835_clk == MAP_FAILED
+       || bcm2835_pwm == MAP_FAILED)
+    return; /* bcm2835_init() failed or not root */
+
+  if (channel == 0)
+    bits = BCM2835_PWM0_USEFIFO | BCM2835_PWM0_SERIAL | BCM2835_PWM0_ENABLE;
+  else if (channel == 1)
+    bits = BCM2835_PWM1_USEFIFO | BCM2835_PWM1_SERIAL | BCM2835_PWM1_ENABLE;
+  else
+    return;
+
+  control = bcm2835_peri_read(bcm2835_pwm + BCM2835_PWM_CONTROL) & ~bits;
+  bcm2835_peri_write_nb(bcm2835_pwm + BCM2835_PWM_CONTROL, control | BCM2835_PWM_CLEAR_FIFO);
+
+  if (enabled)
+    {
+      control |= (channel == 0) ? BCM2835_PWM0_USEFIFO | BCM2835_PWM0_ENABLE
+	: BCM2835_PWM1_USEFIFO | BCM2835_PWM1_ENABLE;
+      if (serial)
+	control |= (channel == 0) ? BCM2835_PWM0_SERIAL : BCM2835_PWM1_SERIAL;
+      bcm2835_peri_write_nb(bcm2835_pwm + BCM2835_PWM_CONTROL, control);
+    }
+}
+
+uint32_t bcm2835_pwm_status(void)
+{
+  if (bcm2835_pwm == MAP_FAILED)
+    return 0;
+
+  return bcm2835_peri_read(bcm2835_pwm + BCM2835_PWM_STATUS);
+}
+
+void bcm2835_pwm_clear_status(uint32_t flags)
+{
+  if (bcm2835_pwm == MAP_FAILED)
+    return;
+
+  /* Error flags are cleared by writing 1 */
+  bcm2835_peri_write(bcm2835_pwm + BCM2835_PWM_STATUS, flags);
+}
+
+void bcm2835_pwm_fifo_write(uint32_t data)
+{
+  if (bcm2835_pwm == MAP_FAILED)
+    return;
+
+  bcm2835_peri_write_nb(bcm2835_pwm + BCM2835_PWM_FIF1, data);
+}
+
+void bcm2835_pwm_set_data_pair(uint32_t data0, uint32_t data1)
+{
+  if (   bcm2835_clk == MAP_FAILED
+       || bcm2835_pwm == MAP_FAILED)
+    return; /* bcm2835_init() failed or not root */
+
+  /* Back to back so that both channels pick up their new data together */
+  bcm2835_peri_write_nb(bcm2835_pwm + BCM2835_PWM0_DATA, data0);
+  bcm2835_peri_write_nb(bcm2835_pwm + BCM2835_PWM1_DATA, data1);
+}
+
 /* Allocate page-aligned memory. */
 void *malloc_aligned(size_t size)
 {
@@ -1221,6 +1221,30 @@ typedef enum
 #define BCM2835_PWMCLK_DIV      41
 #define BCM2835_PWM_PASSWRD     (0x5A << 24)  /*!< Password to enable setting PWM clock */
 
+/* Defines for General Purpose Clocks, word offsets (ie 4 byte multiples) */
+#define BCM2835_GPCLK0_CNTL     28
+#define BCM2835_GPCLK0_DIV      29
+#define BCM2835_GPCLK1_CNTL     30
+#define BCM2835_GPCLK1_DIV      31
+#define BCM2835_GPCLK2_CNTL     32
+#define BCM2835_GPCLK2_DIV      33
+#define BCM2835_GPCLK_PASSWRD   (0x5A << 24)  /*!< Password to enable setting GP clocks */
+#define BCM2835_GPCLK_BUSY      0x80          /*!< Clock generator is running */
+#define BCM2835_GPCLK_ENAB      0x10          /*!< Enable the clock generator */
+
+/*! \brief bcm2835GPClockSource
+  Clock sources for the general purpose clocks.
+*/
+typedef enum
+{
+    BCM2835_GPCLK_SRC_GND   = 0,  /*!< Ground, no output */
+    BCM2835_GPCLK_SRC_OSC   = 1,  /*!< Oscillator, 19.2MHz, 54MHz on RPI 4 */
+    BCM2835_GPCLK_SRC_PLLA  = 4,  /*!< PLLA per */
+    BCM2835_GPCLK_SRC_PLLC  = 5,  /*!< PLLC per, varies with core clock */
+    BCM2835_GPCLK_SRC_PLLD  = 6,  /*!< PLLD per, 500MHz, 750MHz on RPI 4 */
+    BCM2835_GPCLK_SRC_HDMI  = 7   /*!< HDMI auxiliary */
+} bcm2835GPClockSource;
+
 #define BCM2835_PWM1_MS_MODE    0x8000  /*!< Run in Mark/Space mode */
 #define BCM2835_PWM1_USEFIFO    0x2000  /*!< Data from FIFO */
 #define BCM2835_PWM1_REVPOLAR   0x1000  /*!< Reverse polarity */
@@ -1238,6 +1262,12 @@ typedef enum
 #define BCM2835_PWM0_SERIAL     0x0002  /*!< Run in serial mode */
 #define BCM2835_PWM0_ENABLE     0x0001  /*!< Channel Enable */
 
+#define BCM2835_PWM_STA_FULL1   0x0001  /*!< FIFO full */
+#define BCM2835_PWM_STA_EMPT1   0x0002  /*!< FIFO empty */
+#define BCM2835_PWM_STA_WERR1   0x0004  /*!< FIFO write when full */
+#define BCM2835_PWM_STA_RERR1   0x0008  /*!< FIFO read when empty */
+#define BCM2835_PWM_STA_BERR    0x0100  /*!< Bus error */
+
 /*! \brief bcm2835PWMClockDivider
   Specifies the divider used to generate the PWM clock from the system clock.
   Figures below give the divider, clock period and clock frequency.
@@ -1469,6 +1499,26 @@ extern "C" {
       \param[in] mask Mask of pins to clear. Use eg: (1 << RPI_GPIO_P1_03) | (1 << RPI_GPIO_P1_05)
     */
     extern void bcm2835_gpio_set_eds_multi(uint32_t mask);
+
+    /*! Reads the current levels of all 32 pins in the given bank with a
+      single register access.
+      \param[in] bank 0 for GPIO 0 to 31, 1 for GPIO 32 to 53.
+      \return Mask of pins in the bank which are HIGH.
+    */
+    extern uint32_t bcm2835_gpio_lev_bank(uint8_t bank);
+
+    /*! Same as bcm2835_gpio_eds_multi() but for any bank of pins.
+      \param[in] bank 0 for GPIO 0 to 31, 1 for GPIO 32 to 53.
+      \param[in] mask Mask of pins within the bank to check.
+      \return Mask of pins HIGH if the event detect status for the given pin is true.
+    */
+    extern uint32_t bcm2835_gpio_eds_bank(uint8_t bank, uint32_t mask);
+
+    /*! Same as bcm2835_gpio_set_eds_multi() but for any bank of pins.
+      \param[in] bank 0 for GPIO 0 to 31, 1 for GPIO 32 to 53.
+      \param[in] mask Mask of pins within the bank to clear.
+    */
+    extern void bcm2835_gpio_set_eds_bank(uint8_t bank, uint32_t mask);
     
     /*! Enable Rising Edge Detect Enable for the specified pin.
       When a rising edge is detected, sets the appropriate pin in Event Detect Status.
@@ -1631,6 +1681,14 @@ extern "C" {
     */
     extern void bcm2835_gpio_write_mask(uint32_t value, uint32_t mask);
 
+    /*! Same as bcm2835_gpio_write_mask() but for any bank of pins.  At most
+      one SET and one CLR register write is made, and none if the mask is empty.
+      \param[in] bank 0 for GPIO 0 to 31, 1 for GPIO 32 to 53.
+      \param[in] value values required for each bit masked in by mask.
+      \param[in] mask Mask of pins within the bank to affect.
+    */
+    extern void bcm2835_gpio_write_mask_bank(uint8_t bank, uint32_t value, uint32_t mask);
+
     /*! Sets the Pull-up/down mode for the specified pin. This is more convenient than
       clocking the mode in with bcm2835_gpio_pud() and bcm2835_gpio_pudclk().
       \param[in] pin GPIO number, or one of RPI_GPIO_P1_* from \ref RPiGPIOPin.
@@ -1944,6 +2002,31 @@ extern "C" {
 
     /*! @}  */
 
+    /*! \defgroup gpclk General Purpose Clocks
+      Allows control of the 3 general purpose clock generators, which can be output on
+      a limited subset of GPIO pins set to the appropriate Alt Fun.
+      @{
+    */
+
+    /*! Starts a general purpose clock, stopping it first if it is already running.
+      The output frequency is source / (divi + divf / 4096), where a fractional divisor
+      is only used with MASH filtering enabled.  The minimum divi is 1 without MASH,
+      and 2, 3 and 5 for MASH 1, 2 and 3 respectively.
+      \param[in] clock The clock, 0 to 2.
+      \param[in] source One of BCM2835_GPCLK_SRC_* from \ref bcm2835GPClockSource.
+      \param[in] divi Integer part of the divisor, 1 to 4095.
+      \param[in] divf Fractional part of the divisor, 0 to 4095.
+      \param[in] mash MASH filter stages, 0 to 3.
+    */
+    extern void bcm2835_gpclk_start(uint8_t clock, uint8_t source, uint32_t divi, uint32_t divf, uint8_t mash);
+
+    /*! Stops a general purpose clock, waiting for it to finish its current cycle.
+      \param[in] clock The clock, 0 to 2.
+    */
+    extern void bcm2835_gpclk_stop(uint8_t clock);
+
+    /*! @}  */
+
     /*! \defgroup pwm Pulse Width Modulation
       Allows control of 2 independent PWM channels. A limited subset of GPIO pins
       can be connected to one of these 2 channels, allowing PWM control of GPIO pins.
@@ -1958,6 +2041,16 @@ extern "C" {
       values BCM2835_PWM_CLOCK_DIVIDER_* in \ref bcm2835PWMClockDivider
     */
     extern void bcm2835_pwm_set_clock(uint32_t divisor);
+
+    /*! Gets the current PWM clock divisor, as set by bcm2835_pwm_set_clock().
+      \return the divisor, or 0 if the PWM clock is not enabled or not running from the oscillator.
+    */
+    extern uint32_t bcm2835_pwm_get_clock(void);
+
+    /*! Gets the frequency of the oscillator clock source used for the PWM clock.
+      \return 54000000 on RPI 4, 19200000 on earlier models.
+    */
+    extern uint32_t bcm2835_osc_freq(void);
     
     /*! Sets the mode of the given PWM channel,
       allowing you to control the PWM mode and enable/disable that channel
@@ -1982,6 +2075,39 @@ extern "C" {
     */
     extern void bcm2835_pwm_set_data(uint8_t channel, uint32_t data);
 
+    /*! Sets the DATA for both PWM channels with back to back register writes, so that
+      both normally take effect from the same PWM period.
+      \param[in] data0 DATA for channel 0.
+      \param[in] data1 DATA for channel 1.
+    */
+    extern void bcm2835_pwm_set_data_pair(uint32_t data0, uint32_t data1);
+
+    /*! Switches a PWM channel to take its data from the PWM FIFO rather than the DATA
+      register, clearing the FIFO.  In serial mode each FIFO word is shifted out MSB first,
+      using RANGE bits of it, otherwise each word is used as DATA for one PWM period.
+      With enabled false the channel is disabled and returned to using the DATA register.
+      \param[in] channel The PWM channel. 0 or 1.
+      \param[in] serial Run in serialiser mode.
+      \param[in] enabled Enable the channel.
+    */
+    extern void bcm2835_pwm_set_fifo_mode(uint8_t channel, uint8_t serial, uint8_t enabled);
+
+    /*! Reads the PWM status register.
+      \return STA, a combination of BCM2835_PWM_STA_* flags.
+    */
+    extern uint32_t bcm2835_pwm_status(void);
+
+    /*! Clears PWM status error flags.
+      \param[in] flags BCM2835_PWM_STA_* error flags to clear.
+    */
+    extern void bcm2835_pwm_clear_status(uint32_t flags);
+
+    /*! Writes a word to the PWM FIFO.  The caller should check that the FIFO is not
+      full with bcm2835_pwm_status() first.
+      \param[in] data The word to write.
+    */
+    extern void bcm2835_pwm_fifo_write(uint32_t data);
+
     /*! @}  */
 #ifdef __cplusplus
 }
@@ -25,19 +25,38 @@
  */
 #if defined(__linux__)
 
+#include <algorithm>	/* std::rotate(), std::push_heap() */
+#include <math.h>	/* fabs() */
+#include <pthread.h>
+#include <string.h>	/* memmove() */
+#include <sys/mman.h>	/* MAP_FAILED */
+#include <time.h>	/* nanosleep() */
 #include <unistd.h>	/* usleep() */
+#include <vector>
 #include "bcm2835.h"
 #include "sunxi.h"
 
 #define RPIO_EVENT_LOW	0x1
 #define RPIO_EVENT_HIGH	0x2
 
+#define RPIO_TRIGGER_LEVEL	0x0
+#define RPIO_TRIGGER_EDGE	0x1
+
+#define RPIO_PORT_BANK0	0x0
+#define RPIO_PORT_BANK1	0x1
+#define RPIO_PORT_ALL	0x2
+
 /* Avoid writing these monstrosities everywhere */
 #define IS_OBJ(i)	info[i]->IsObject()
 #define IS_U32(i)	info[i]->IsUint32()
+#define IS_U32A(i)	info[i]->IsUint32Array()
+#define IS_FUNC(i)	info[i]->IsFunction()
+#define IS_NUM(i)	info[i]->IsNumber()
+#define IS_F64A(i)	info[i]->IsFloat64Array()
 #define FROM_OBJ(i) \
 	node::Buffer::Data(Nan::To<v8::Object>(info[i]).ToLocalChecked())
 #define FROM_U32(i)	Nan::To<uint32_t>(info[i]).FromJust()
+#define FROM_NUM(i)	Nan::To<double>(info[i]).FromJust()
 #define NAN_ARGC	info.Length()
 #define NAN_RETURN	info.GetReturnValue().Set
 
@@ -85,6 +104,40 @@
 			return ThrowTypeError("Invalid arg4");		\
 	} while (0)
 
+#define ASSERT_ARGC5(t0, t1, t2, t3, t4)				\
+	do {								\
+		if (NAN_ARGC != 5)					\
+			return ThrowTypeError("Invalid argc");		\
+		if (!t0(0))						\
+			return ThrowTypeError("Invalid arg1");		\
+		if (!t1(1))						\
+			return ThrowTypeError("Invalid arg2");		\
+		if (!t2(2))						\
+			return ThrowTypeError("Invalid arg3");		\
+		if (!t3(3))						\
+			return ThrowTypeError("Invalid arg4");		\
+		if (!t4(4))						\
+			return ThrowTypeError("Invalid arg5");		\
+	} while (0)
+
+#define ASSERT_ARGC6(t0, t1, t2, t3, t4, t5)				\
+	do {								\
+		if (NAN_ARGC != 6)					\
+			return ThrowTypeError("Invalid argc");		\
+		if (!t0(0))						\
+			return ThrowTypeError("Invalid arg1");		\
+		if (!t1(1))						\
+			return ThrowTypeError("Invalid arg2");		\
+		if (!t2(2))						\
+			return ThrowTypeError("Invalid arg3");		\
+		if (!t3(3))						\
+			return ThrowTypeError("Invalid arg4");		\
+		if (!t4(4))						\
+			return ThrowTypeError("Invalid arg5");		\
+		if (!t5(5))						\
+			return ThrowTypeError("Invalid arg6");		\
+	} while (0)
+
 using namespace Nan;
 
 #define RPIO_SOC_BCM2835	0x0
@@ -92,6 +145,72 @@ using namespace Nan;
 
 uint32_t soctype = RPIO_SOC_BCM2835;
 
+/*
+ * Microsecond timestamps.  The system timer is only mapped when we have full
+ * /dev/mem access, so fall back to CLOCK_MONOTONIC under /dev/gpiomem.
+ */
+static uint64_t
+rpio_timestamp(void)
+{
+	struct timespec ts;
+	uint64_t st;
+
+	if ((st = bcm2835_st_read()))
+		return st;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+ * Cheaper variant for sampling loops which only reads the low word of the
+ * system timer, wrapping every ~71 minutes.
+ */
+static inline uint32_t
+rpio_timestamp32(void)
+{
+	if (bcm2835_st != MAP_FAILED)
+		return bcm2835_peri_read(bcm2835_st + BCM2835_ST_CLO/4);
+
+	return (uint32_t)rpio_timestamp();
+}
+
+/*
+ * Wait until the low word of the system timer reaches "deadline".  Uses the
+ * same hybrid approach as bcm2835_delayMicroseconds(): long waits sleep until
+ * shortly before the deadline, and the rest is a busy wait on the timer for
+ * accuracy.  Returns how many microseconds late we were, 0 if on time.
+ */
+static uint32_t
+rpio_wait_until(uint32_t deadline)
+{
+	struct timespec ts;
+	int32_t remain;
+
+	remain = (int32_t)(deadline - rpio_timestamp32());
+	if (remain > 450) {
+		ts.tv_sec = (remain - 200) / 1000000;
+		ts.tv_nsec = ((remain - 200) % 1000000) * 1000;
+		nanosleep(&ts, NULL);
+	}
+
+	while ((remain = (int32_t)(deadline - rpio_timestamp32())) > 0)
+		;
+
+	return (uint32_t)-remain;
+}
+
+/*
+ * Deadline of sample "n" for a capture starting at "start" running at "rate"
+ * samples per second, calculated from the start rather than accumulated so
+ * that rates which do not divide 1MHz do not drift.
+ */
+static inline uint32_t
+rpio_deadline(uint32_t start, uint32_t n, uint32_t rate)
+{
+	return start + (uint32_t)((uint64_t)n * 1000000 / rate);
+}
+
 /*
  * GPIO function select.
  */
@@ -168,6 +287,396 @@ NAN_METHOD(gpio_readbuf)
 	}
 }
 
+/*
+ * Same as gpio_readbuf but also record a timestamp every "every" samples into
+ * a Uint32Array, giving an accurate time base for the capture.
+ */
+NAN_METHOD(gpio_readbuf_timed)
+{
+	ASSERT_ARGC6(IS_U32, IS_OBJ, IS_U32, IS_U32A, IS_U32, IS_U32);
+
+	uint32_t pin = FROM_U32(0);
+	char *buf = FROM_OBJ(1);
+	uint32_t len = FROM_U32(2);
+	Nan::TypedArrayContents<uint32_t> stamps(info[3]);
+	uint32_t every = FROM_U32(4);
+	uint32_t mode = FROM_U32(5);
+	uint32_t *stamp = *stamps;
+	uint32_t i, next;
+
+	if (every == 0)
+		return ThrowRangeError("Timestamp interval must be non-zero");
+
+	switch (soctype) {
+	case RPIO_SOC_BCM2835:
+		if (mode) {
+			bcm2835_gpio_fsel(pin, 0);
+		}
+		for (i = 0, next = 0; i < len; i++) {
+			if (i == next) {
+				*stamp++ = rpio_timestamp32();
+				next += every;
+			}
+			buf[i] = bcm2835_gpio_lev(pin);
+		}
+		break;
+	case RPIO_SOC_SUNXI:
+		if (mode) {
+			sunxi_gpio_fsel(pin, 0);
+		}
+		for (i = 0, next = 0; i < len; i++) {
+			if (i == next) {
+				*stamp++ = rpio_timestamp32();
+				next += every;
+			}
+			buf[i] = sunxi_gpio_lev(pin);
+		}
+		break;
+	}
+}
+
+/*
+ * Same as gpio_readbuf but pack 8 samples into each byte, the first sample in
+ * the most significant bit, to reduce the memory and cache footprint of long
+ * captures.  On bcm2835 the level register is read directly without a barrier
+ * between samples, as nothing else is accessed until the loop completes.
+ */
+NAN_METHOD(gpio_readbuf_packed)
+{
+	ASSERT_ARGC4(IS_U32, IS_OBJ, IS_U32, IS_U32);
+
+	uint32_t pin = FROM_U32(0);
+	char *buf = FROM_OBJ(1);
+	uint32_t samples = FROM_U32(2);
+	uint32_t mode = FROM_U32(3);
+	volatile uint32_t *lev;
+	uint32_t i, shift;
+	uint8_t acc = 0;
+
+	switch (soctype) {
+	case RPIO_SOC_BCM2835:
+		if (mode) {
+			bcm2835_gpio_fsel(pin, 0);
+		}
+		lev = bcm2835_gpio + BCM2835_GPLEV0/4 + pin/32;
+		shift = pin % 32;
+		__sync_synchronize();
+		for (i = 0; i < samples; i++) {
+			acc = (acc << 1) | ((bcm2835_peri_read_nb(lev) >> shift) & 1);
+			if ((i & 7) == 7)
+				buf[i >> 3] = acc;
+		}
+		__sync_synchronize();
+		break;
+	case RPIO_SOC_SUNXI:
+		if (mode) {
+			sunxi_gpio_fsel(pin, 0);
+		}
+		for (i = 0; i < samples; i++) {
+			acc = (acc << 1) | sunxi_gpio_lev(pin);
+			if ((i & 7) == 7)
+				buf[i >> 3] = acc;
+		}
+		break;
+	}
+
+	/* Left-align any trailing partial byte. */
+	if (samples & 7)
+		buf[samples >> 3] = acc << (8 - (samples & 7));
+}
+
+/*
+ * Transition capture.  Rather than storing every sample, only record the
+ * level changes of a pin along with the time in microseconds since the start
+ * of the capture, as [usecs, level] pairs.  The first entry is always the
+ * initial level at time 0.  Stops once "max" entries have been recorded or
+ * "timeout" microseconds have passed, returning the number of entries.
+ */
+static inline uint8_t
+read_edges_lev(uint32_t pin, volatile uint32_t *lev)
+{
+	if (soctype == RPIO_SOC_SUNXI)
+		return sunxi_gpio_lev(pin);
+
+	return (bcm2835_peri_read(lev) >> (pin % 32)) & 1;
+}
+
+NAN_METHOD(gpio_read_edges)
+{
+	ASSERT_ARGC5(IS_U32, IS_U32A, IS_U32, IS_U32, IS_U32);
+
+	uint32_t pin = FROM_U32(0);
+	Nan::TypedArrayContents<uint32_t> edges(info[1]);
+	uint32_t max = FROM_U32(2);
+	uint32_t timeout = FROM_U32(3);
+	uint32_t mode = FROM_U32(4);
+	volatile uint32_t *lev = NULL;
+	uint32_t *out = *edges;
+	uint32_t count, start, now;
+	uint8_t level, last;
+
+	if (max == 0) {
+		NAN_RETURN(0);
+		return;
+	}
+
+	switch (soctype) {
+	case RPIO_SOC_BCM2835:
+		if (mode) {
+			bcm2835_gpio_fsel(pin, 0);
+		}
+		lev = bcm2835_gpio + BCM2835_GPLEV0/4 + pin/32;
+		break;
+	case RPIO_SOC_SUNXI:
+		if (mode) {
+			sunxi_gpio_fsel(pin, 0);
+		}
+		break;
+	}
+
+	start = rpio_timestamp32();
+	last = read_edges_lev(pin, lev);
+	out[0] = 0;
+	out[1] = last;
+
+	for (count = 1; count < max; ) {
+		level = read_edges_lev(pin, lev);
+		now = rpio_timestamp32() - start;
+		if (level != last) {
+			out[count * 2] = now;
+			out[count * 2 + 1] = level;
+			last = level;
+			count++;
+		}
+		if (now >= timeout)
+			break;
+	}
+
+	NAN_RETURN(count);
+}
+
+/*
+ * Fixed-rate sampling.  Rather than reading as fast as the loop runs, pace
+ * each sample against the 1MHz system timer at "rate" samples per second (up
+ * to 1MHz), so that samples are evenly spaced regardless of CPU frequency or
+ * cache state.  Returns the number of samples which missed their deadline.
+ */
+NAN_METHOD(gpio_sample)
+{
+	ASSERT_ARGC5(IS_U32, IS_OBJ, IS_U32, IS_U32, IS_U32);
+
+	uint32_t pin = FROM_U32(0);
+	char *buf = FROM_OBJ(1);
+	uint32_t len = FROM_U32(2);
+	uint32_t rate = FROM_U32(3);
+	uint32_t mode = FROM_U32(4);
+	uint32_t i, start, missed = 0;
+
+	if (rate == 0 || rate > 1000000)
+		return ThrowRangeError("Sample rate must be between 1Hz and 1MHz");
+
+	switch (soctype) {
+	case RPIO_SOC_BCM2835:
+		if (mode) {
+			bcm2835_gpio_fsel(pin, 0);
+		}
+		start = rpio_timestamp32();
+		for (i = 0; i < len; i++) {
+			if (rpio_wait_until(rpio_deadline(start, i, rate)))
+				missed++;
+			buf[i] = bcm2835_gpio_lev(pin);
+		}
+		break;
+	case RPIO_SOC_SUNXI:
+		if (mode) {
+			sunxi_gpio_fsel(pin, 0);
+		}
+		start = rpio_timestamp32();
+		for (i = 0; i < len; i++) {
+			if (rpio_wait_until(rpio_deadline(start, i, rate)))
+				missed++;
+			buf[i] = sunxi_gpio_lev(pin);
+		}
+		break;
+	}
+
+	NAN_RETURN(missed);
+}
+
+/*
+ * Logic analyzer capture.  Store the GPLEV word of each bank with a non-zero
+ * channel mask, ANDed with that mask, into a Uint32Array on each sample, one
+ * read sampling all channels in the bank at once.  If both banks are in use
+ * then each sample takes two consecutive words, GPLEV0 first.
+ *
+ * With a rate of 0 samples are taken as fast as possible, otherwise they are
+ * paced as for gpio_sample and the number of missed deadlines is returned.
+ */
+NAN_METHOD(gpio_capture)
+{
+	ASSERT_ARGC5(IS_U32, IS_U32, IS_U32A, IS_U32, IS_U32);
+
+	uint32_t mask0 = FROM_U32(0);
+	uint32_t mask1 = FROM_U32(1);
+	Nan::TypedArrayContents<uint32_t> words(info[2]);
+	uint32_t samples = FROM_U32(3);
+	uint32_t rate = FROM_U32(4);
+	volatile uint32_t *lev = bcm2835_gpio + BCM2835_GPLEV0/4;
+	uint32_t *out = *words;
+	uint32_t i, start, missed = 0;
+
+	if (soctype != RPIO_SOC_BCM2835)
+		return ThrowError("Port reads are only supported on bcm2835");
+	if (rate > 1000000)
+		return ThrowRangeError("Sample rate must be at most 1MHz");
+
+	start = rpio_timestamp32();
+	for (i = 0; i < samples; i++) {
+		if (rate && rpio_wait_until(rpio_deadline(start, i, rate)))
+			missed++;
+		if (mask0)
+			*out++ = bcm2835_peri_read(lev) & mask0;
+		if (mask1)
+			*out++ = bcm2835_peri_read(lev + 1) & mask1;
+	}
+
+	NAN_RETURN(missed);
+}
+
+/*
+ * Triggered capture.  Continuously sample a GPLEV word and timestamp into a
+ * ring of "pre" entries at the start of the words/stamps arrays until the
+ * trigger sequence completes, then fill the remainder of the arrays with
+ * post-trigger samples, the first of which is the sample which fired the
+ * trigger.
+ *
+ * Triggers are [mask, value, type] triples, and each must match in turn.  A
+ * level trigger matches any sample where (word & mask) == value, an edge
+ * trigger only matches on the first sample that does so.
+ *
+ * Once done the pre-trigger ring is put into chronological order and the
+ * number of pre-trigger samples captured is returned, which is less than
+ * "pre" if the trigger fired early.  The post-trigger samples immediately
+ * follow them.  Returns -1 if the trigger did not fire within "timeout"
+ * microseconds.
+ */
+NAN_METHOD(gpio_capture_trigger)
+{
+	ASSERT_ARGC6(IS_U32, IS_U32A, IS_U32A, IS_U32A, IS_U32, IS_U32);
+
+	uint32_t bank = FROM_U32(0);
+	Nan::TypedArrayContents<uint32_t> triggers(info[1]);
+	Nan::TypedArrayContents<uint32_t> words(info[2]);
+	Nan::TypedArrayContents<uint32_t> stamps(info[3]);
+	uint32_t pre = FROM_U32(4);
+	uint32_t timeout = FROM_U32(5);
+	uint32_t ntrig = triggers.length() / 3;
+	uint32_t len = std::min(words.length(), stamps.length());
+	uint32_t *trig = *triggers;
+	uint32_t *wout = *words;
+	uint32_t *sout = *stamps;
+	volatile uint32_t *lev;
+	uint32_t i, word, now, start, head, count, stage, *t;
+	bool match, prev;
+
+	if (soctype != RPIO_SOC_BCM2835)
+		return ThrowError("Port reads are only supported on bcm2835");
+	if (bank > RPIO_PORT_BANK1)
+		return ThrowRangeError("Invalid GPIO bank");
+	if (ntrig == 0)
+		return ThrowRangeError("No trigger specified");
+	if (pre >= len)
+		return ThrowRangeError("No room for post-trigger samples");
+
+	lev = bcm2835_gpio + BCM2835_GPLEV0/4 + bank;
+	head = count = stage = 0;
+	t = trig;
+	prev = true;	/* Edge triggers cannot fire on the first sample */
+	start = rpio_timestamp32();
+
+	for (;;) {
+		word = bcm2835_peri_read(lev);
+		now = rpio_timestamp32();
+
+		if (now - start >= timeout) {
+			NAN_RETURN(-1);
+			return;
+		}
+
+		match = (word & t[0]) == t[1];
+		if (match && (t[2] == RPIO_TRIGGER_LEVEL || !prev)) {
+			if (++stage == ntrig)
+				break;
+			t = trig + stage * 3;
+			match = (word & t[0]) == t[1];
+		}
+		prev = match;
+
+		if (pre) {
+			wout[head] = word;
+			sout[head] = now;
+			if (++head == pre)
+				head = 0;
+			count++;
+		}
+	}
+
+	wout[pre] = word;
+	sout[pre] = now;
+	for (i = pre + 1; i < len; i++) {
+		wout[i] = bcm2835_peri_read(lev);
+		sout[i] = rpio_timestamp32();
+	}
+
+	if (count >= pre) {
+		std::rotate(wout, wout + head, wout + pre);
+		std::rotate(sout, sout + head, sout + pre);
+	} else {
+		memmove(wout + count, wout + pre, (len - pre) * sizeof(*wout));
+		memmove(sout + count, sout + pre, (len - pre) * sizeof(*sout));
+		pre = count;
+	}
+
+	NAN_RETURN(pre);
+}
+
+/*
+ * Read the levels of a whole bank of pins with a single register access,
+ * returning GPLEV0 or GPLEV1.  RPIO_PORT_ALL returns both banks as a BigInt,
+ * on versions of node which support it.
+ */
+NAN_METHOD(gpio_read_port)
+{
+	ASSERT_ARGC1(IS_U32);
+
+	uint32_t bank = FROM_U32(0);
+
+	if (soctype != RPIO_SOC_BCM2835)
+		return ThrowError("Port reads are only supported on bcm2835");
+
+	switch (bank) {
+	case RPIO_PORT_BANK0:
+	case RPIO_PORT_BANK1:
+		NAN_RETURN(bcm2835_gpio_lev_bank(bank));
+		break;
+	case RPIO_PORT_ALL:
+#if V8_MAJOR_VERSION >= 7
+	{
+		uint64_t lo = bcm2835_gpio_lev_bank(0);
+		uint64_t hi = bcm2835_gpio_lev_bank(1);
+
+		NAN_RETURN(v8::BigInt::NewFromUnsigned(
+		    v8::Isolate::GetCurrent(), (hi << 32) | lo));
+		break;
+	}
+#else
+		return ThrowError("BigInt is not supported by this node version");
+#endif
+	default:
+		return ThrowRangeError("Invalid GPIO bank");
+	}
+}
+
 NAN_METHOD(gpio_write)
 {
 	ASSERT_ARGC2(IS_U32, IS_U32);
@@ -187,6 +696,26 @@ NAN_METHOD(gpio_write)
 	NAN_RETURN(val);
 }
 
+/*
+ * Write many pins at once, as value/mask pairs for GPIO 0-31 and GPIO 32-53.
+ * All pins in a bank change in the same bus cycle.
+ */
+NAN_METHOD(gpio_write_mask)
+{
+	ASSERT_ARGC4(IS_U32, IS_U32, IS_U32, IS_U32);
+
+	uint32_t value0 = FROM_U32(0);
+	uint32_t mask0 = FROM_U32(1);
+	uint32_t value1 = FROM_U32(2);
+	uint32_t mask1 = FROM_U32(3);
+
+	if (soctype != RPIO_SOC_BCM2835)
+		return ThrowError("Port writes are only supported on bcm2835");
+
+	bcm2835_gpio_write_mask_bank(0, value0, mask0);
+	bcm2835_gpio_write_mask_bank(1, value1, mask1);
+}
+
 NAN_METHOD(gpio_writebuf)
 {
 	ASSERT_ARGC3(IS_U32, IS_OBJ, IS_U32);
@@ -209,6 +738,81 @@ NAN_METHOD(gpio_writebuf)
 	}
 }
 
+/*
+ * Timed waveform playback.  Write each level in buf to the pin and hold it
+ * for the matching entry in durations, or for a fixed period if durations is
+ * empty, pacing each step against the system timer.  Only returns once the
+ * final level has been held for its duration.  Returns the worst lateness of
+ * any step in microseconds.
+ */
+NAN_METHOD(gpio_writebuf_timed)
+{
+	ASSERT_ARGC5(IS_U32, IS_OBJ, IS_U32, IS_U32A, IS_U32);
+
+	uint32_t pin = FROM_U32(0);
+	char *buf = FROM_OBJ(1);
+	uint32_t len = FROM_U32(2);
+	Nan::TypedArrayContents<uint32_t> durations(info[3]);
+	uint32_t period = FROM_U32(4);
+	uint32_t *duration = durations.length() ? *durations : NULL;
+	uint32_t i, deadline, late, worst = 0;
+
+	if (duration && durations.length() < len)
+		return ThrowRangeError("Not enough durations for buffer");
+
+	deadline = rpio_timestamp32();
+	for (i = 0; i < len; i++) {
+		if ((late = rpio_wait_until(deadline)) > worst)
+			worst = late;
+		switch (soctype) {
+		case RPIO_SOC_BCM2835:
+			bcm2835_gpio_write(pin, buf[i]);
+			break;
+		case RPIO_SOC_SUNXI:
+			sunxi_gpio_write(pin, buf[i]);
+			break;
+		}
+		deadline += duration ? duration[i] : period;
+	}
+	rpio_wait_until(deadline);
+
+	NAN_RETURN(worst);
+}
+
+/*
+ * Parallel waveform playback.  Drive every pin in a GPIO0-31 mask from a
+ * Uint32Array of raw GPIO words, one step per word, with a single GPSET/GPCLR
+ * store pair per step so that all pins change together.  Returns the worst
+ * lateness of any step in microseconds.
+ */
+NAN_METHOD(gpio_write_mask_timed)
+{
+	ASSERT_ARGC4(IS_U32A, IS_U32, IS_U32, IS_U32);
+
+	Nan::TypedArrayContents<uint32_t> words(info[0]);
+	uint32_t len = FROM_U32(1);
+	uint32_t mask = FROM_U32(2);
+	uint32_t period = FROM_U32(3);
+	uint32_t *word = *words;
+	uint32_t i, deadline, late, worst = 0;
+
+	if (soctype != RPIO_SOC_BCM2835)
+		return ThrowError("Port writes are only supported on bcm2835");
+	if (len > words.length())
+		return ThrowRangeError("Array not large enough for request");
+
+	deadline = rpio_timestamp32();
+	for (i = 0; i < len; i++) {
+		if ((late = rpio_wait_until(deadline)) > worst)
+			worst = late;
+		bcm2835_gpio_write_mask(word[i], mask);
+		deadline += period;
+	}
+	rpio_wait_until(deadline);
+
+	NAN_RETURN(worst);
+}
+
 NAN_METHOD(gpio_pad_read)
 {
 	ASSERT_ARGC1(IS_U32);
@@ -245,6 +849,13 @@ NAN_METHOD(gpio_pud)
 	}
 }
 
+/*
+ * The detect enable registers are updated with a read-modify-write, so all
+ * changes to them are serialised, as edge waits may be running on worker
+ * threads at the same time as poll() changes on the main thread.
+ */
+static pthread_mutex_t edge_lock = PTHREAD_MUTEX_INITIALIZER;
+
 NAN_METHOD(gpio_event_set)
 {
 	ASSERT_ARGC2(IS_U32, IS_U32);
@@ -252,6 +863,8 @@ NAN_METHOD(gpio_event_set)
 	uint32_t pin = FROM_U32(0);
 	uint32_t direction = FROM_U32(1);
 
+	pthread_mutex_lock(&edge_lock);
+
 	/* Clear all possible trigger events. */
 	bcm2835_gpio_clr_ren(pin);
 	bcm2835_gpio_clr_fen(pin);
@@ -271,35 +884,1138 @@ NAN_METHOD(gpio_event_set)
 	if (direction & RPIO_EVENT_LOW) {
 		bcm2835_gpio_fen(pin);
 	}
+
+	pthread_mutex_unlock(&edge_lock);
+}
+
+/*
+ * Event detection.  Interrupts are not supported, so instead of having JS
+ * poll the EDS register on a timer, a watcher thread samples it every
+ * event_period microseconds.  Each latched edge is recorded along with the
+ * pin's new level and a timestamp into a single-producer single-consumer
+ * ring, and the event loop is woken via a uv_async_t handle to collect
+ * everything queued so far as a single batch.
+ *
+ * The EDS register only says that an edge happened since the last sample,
+ * so multiple edges on a pin within one period are recorded as one, using
+ * the level at the time of the sample.
+ */
+#define EVENT_RING_SIZE		4096	/* Must be a power of two */
+
+struct event_edge {
+	uint64_t usecs;
+	uint8_t gpio;
+	uint8_t level;
+};
+
+static struct event_edge event_ring[EVENT_RING_SIZE];
+static uint32_t event_head;	/* Only written by the watcher thread */
+static uint32_t event_tail;	/* Only written by the event loop */
+static uint32_t event_dropped;
+
+/*
+ * The callback and its resource live with the async handle and are released
+ * when it has closed, as the last pin is often unpolled from inside its own
+ * callback, while event_deliver() is still using them.
+ */
+struct event_handle {
+	uv_async_t async;
+	Nan::Callback *cb;
+	Nan::AsyncResource *resource;
+};
+
+static pthread_t event_thread;
+static struct event_handle *event_handle;
+static uint32_t event_running;
+static uint32_t event_mask[2];
+static uint32_t event_period = 50;
+
+static void
+event_record(uint8_t bank, uint32_t active, uint64_t usecs)
+{
+	struct event_edge *edge;
+	uint32_t head, tail, levels;
+	uint8_t gpio;
+
+	levels = bcm2835_gpio_lev_bank(bank);
+
+	head = event_head;
+	tail = __atomic_load_n(&event_tail, __ATOMIC_ACQUIRE);
+
+	for (gpio = 0; active; gpio++, active >>= 1) {
+		if (!(active & 1))
+			continue;
+		if (head - tail == EVENT_RING_SIZE) {
+			__atomic_fetch_add(&event_dropped, 1, __ATOMIC_RELAXED);
+			continue;
+		}
+		edge = &event_ring[head & (EVENT_RING_SIZE - 1)];
+		edge->usecs = usecs;
+		edge->gpio = bank * 32 + gpio;
+		edge->level = (levels >> gpio) & 1;
+		head++;
+	}
+
+	__atomic_store_n(&event_head, head, __ATOMIC_RELEASE);
+}
+
+/*
+ * Both EDS banks are checked on each pass, but only if a pin in that bank is
+ * being watched, so the common case of header pins only costs a single read.
+ */
+static void *
+event_watch(void *arg)
+{
+	struct timespec ts;
+	uint32_t active[2], period;
+	uint64_t usecs;
+	uint8_t bank;
+
+	while (__atomic_load_n(&event_running, __ATOMIC_ACQUIRE)) {
+		usecs = 0;
+
+		for (bank = 0; bank < 2; bank++) {
+			active[bank] = __atomic_load_n(&event_mask[bank],
+			    __ATOMIC_RELAXED);
+			if (active[bank])
+				active[bank] = bcm2835_gpio_eds_bank(bank,
+				    active[bank]);
+			if (!active[bank])
+				continue;
+			bcm2835_gpio_set_eds_bank(bank, active[bank]);
+			if (!usecs)
+				usecs = rpio_timestamp();
+			event_record(bank, active[bank], usecs);
+		}
+
+		if (usecs)
+			uv_async_send(&event_handle->async);
+
+		period = __atomic_load_n(&event_period, __ATOMIC_RELAXED);
+		ts.tv_sec = period / 1000000;
+		ts.tv_nsec = (period % 1000000) * 1000;
+		nanosleep(&ts, NULL);
+	}
+
+	return NULL;
+}
+
+/*
+ * Hand everything currently in the ring to JS as a Float64Array of
+ * [gpio, level, usecs] triples, along with the number of edges dropped
+ * since the last batch due to the ring being full.
+ */
+static NAUV_WORK_CB(event_deliver)
+{
+	Nan::HandleScope scope;
+	struct event_handle *handle;
+	struct event_edge *edge;
+	uint32_t head, tail, count, dropped;
+	double *out;
+
+	handle = reinterpret_cast<struct event_handle *>(async->data);
+
+	head = __atomic_load_n(&event_head, __ATOMIC_ACQUIRE);
+	tail = event_tail;
+	dropped = __atomic_exchange_n(&event_dropped, 0, __ATOMIC_RELAXED);
+
+	if ((count = head - tail) == 0 && dropped == 0)
+		return;
+
+	v8::Local<v8::ArrayBuffer> ab = v8::ArrayBuffer::New(
+	    v8::Isolate::GetCurrent(), count * 3 * sizeof(double));
+	v8::Local<v8::Float64Array> edges =
+	    v8::Float64Array::New(ab, 0, count * 3);
+	Nan::TypedArrayContents<double> contents(edges);
+	out = *contents;
+
+	for (; tail != head; tail++) {
+		edge = &event_ring[tail & (EVENT_RING_SIZE - 1)];
+		*out++ = edge->gpio;
+		*out++ = edge->level;
+		*out++ = (double)edge->usecs;
+	}
+	__atomic_store_n(&event_tail, tail, __ATOMIC_RELEASE);
+
+	v8::Local<v8::Value> argv[] = { edges, Nan::New<v8::Uint32>(dropped) };
+	handle->cb->Call(2, argv, handle->resource);
+}
+
+static void
+event_close_cb(uv_handle_t *handle)
+{
+	struct event_handle *eh;
+
+	eh = reinterpret_cast<struct event_handle *>(handle->data);
+	delete eh->cb;
+	delete eh->resource;
+	delete eh;
+}
+
+static void
+event_stop(void)
+{
+	if (!event_running)
+		return;
+
+	__atomic_store_n(&event_running, 0, __ATOMIC_RELEASE);
+	pthread_join(event_thread, NULL);
+
+	uv_close(reinterpret_cast<uv_handle_t *>(&event_handle->async),
+	    event_close_cb);
+	event_handle = NULL;
+	event_head = event_tail = event_dropped = 0;
+}
+
+/*
+ * Start the watcher thread, or just update the sample period if it is
+ * already running.
+ */
+NAN_METHOD(gpio_event_start)
+{
+	ASSERT_ARGC2(IS_U32, IS_FUNC);
+
+	if (FROM_U32(0) == 0)
+		return ThrowRangeError("Poll period must be non-zero");
+
+	__atomic_store_n(&event_period, FROM_U32(0), __ATOMIC_RELAXED);
+
+	if (event_running)
+		return;
+
+	event_handle = new struct event_handle;
+	uv_async_init(GetCurrentEventLoop(), &event_handle->async,
+	    event_deliver);
+	event_handle->async.data = event_handle;
+	event_handle->cb = new Nan::Callback(info[1].As<v8::Function>());
+	event_handle->resource = new Nan::AsyncResource("rpio:event");
+
+	event_running = 1;
+	if (pthread_create(&event_thread, NULL, event_watch, NULL) != 0) {
+		event_running = 0;
+		uv_close(reinterpret_cast<uv_handle_t *>(&event_handle->async),
+		    event_close_cb);
+		event_handle = NULL;
+		return ThrowError("Could not start event thread");
+	}
+}
+
+/*
+ * Set the pins to watch, as one mask for each of GPIO 0-31 and GPIO 32-53.
+ */
+NAN_METHOD(gpio_event_mask)
+{
+	ASSERT_ARGC2(IS_U32, IS_U32);
+
+	__atomic_store_n(&event_mask[0], FROM_U32(0), __ATOMIC_RELAXED);
+	__atomic_store_n(&event_mask[1], FROM_U32(1), __ATOMIC_RELAXED);
+}
+
+NAN_METHOD(gpio_event_stop)
+{
+	event_stop();
+}
+
+NAN_METHOD(gpio_event_clear)
+{
+	ASSERT_ARGC1(IS_U32);
+
+	uint32_t pin = FROM_U32(0);
+
+	pthread_mutex_lock(&edge_lock);
+	bcm2835_gpio_clr_fen(pin);
+	bcm2835_gpio_clr_ren(pin);
+	pthread_mutex_unlock(&edge_lock);
+}
+
+/*
+ * Wait for an edge on a single pin using the same edge detect registers as
+ * gpio_event_set().  Returns the system timer timestamp of the edge, or -1
+ * if "timeout" microseconds pass first.  The pin must not also be watched by
+ * the event thread, as that would clear the status bit from under us.
+ *
+ * Synchronous waits spin on EDS for the lowest latency.  Async waits sleep
+ * for EDGE_ASYNC_PERIOD between checks instead, so as not to burn a CPU
+ * from the thread pool; EDS latches the edge, so none are missed, but the
+ * timestamp may be up to that much late.  rpio_close() waits for any async
+ * waits in progress, which give up early once edge_closing is set.
+ */
+#define EDGE_ASYNC_PERIOD	100	/* usecs */
+
+static pthread_cond_t edge_cond = PTHREAD_COND_INITIALIZER;
+static uint32_t edge_pending;
+static uint32_t edge_closing;
+
+static double
+edge_wait(uint8_t pin, uint32_t edge, uint32_t timeout, uint32_t period)
+{
+	uint32_t start;
+	double usecs = -1;
+
+	pthread_mutex_lock(&edge_lock);
+	if (edge_closing) {
+		pthread_mutex_unlock(&edge_lock);
+		return usecs;
+	}
+	bcm2835_gpio_set_eds(pin);
+	if (edge & RPIO_EVENT_HIGH)
+		bcm2835_gpio_ren(pin);
+	if (edge & RPIO_EVENT_LOW)
+		bcm2835_gpio_fen(pin);
+	pthread_mutex_unlock(&edge_lock);
+
+	start = rpio_timestamp32();
+	for (;;) {
+		if (bcm2835_gpio_eds(pin)) {
+			usecs = (double)rpio_timestamp();
+			break;
+		}
+		if (rpio_timestamp32() - start >= timeout)
+			break;
+		if (period) {
+			if (__atomic_load_n(&edge_closing, __ATOMIC_RELAXED))
+				break;
+			usleep(period);
+		}
+	}
+
+	pthread_mutex_lock(&edge_lock);
+	bcm2835_gpio_clr_ren(pin);
+	bcm2835_gpio_clr_fen(pin);
+	bcm2835_gpio_set_eds(pin);
+	pthread_mutex_unlock(&edge_lock);
+
+	return usecs;
+}
+
+NAN_METHOD(gpio_wait_edge)
+{
+	ASSERT_ARGC3(IS_U32, IS_U32, IS_U32);
+
+	if (soctype != RPIO_SOC_BCM2835)
+		return ThrowError("Edge waits are only supported on bcm2835");
+
+	NAN_RETURN(edge_wait(FROM_U32(0), FROM_U32(1), FROM_U32(2), 0));
+}
+
+class EdgeWorker : public Nan::AsyncWorker {
+public:
+	EdgeWorker(Nan::Callback *callback, uint8_t pin, uint32_t edge,
+	    uint32_t timeout)
+	    : Nan::AsyncWorker(callback, "rpio:edge"), pin(pin), edge(edge),
+	    timeout(timeout), usecs(-1) {}
+
+	void Execute()
+	{
+		usecs = edge_wait(pin, edge, timeout, EDGE_ASYNC_PERIOD);
+
+		pthread_mutex_lock(&edge_lock);
+		edge_pending--;
+		pthread_cond_broadcast(&edge_cond);
+		pthread_mutex_unlock(&edge_lock);
+	}
+
+	void HandleOKCallback()
+	{
+		Nan::HandleScope scope;
+		v8::Local<v8::Value> argv[] = {
+			Nan::Null(), Nan::New<v8::Number>(usecs)
+		};
+		callback->Call(2, argv, async_resource);
+	}
+
+private:
+	uint8_t pin;
+	uint32_t edge;
+	uint32_t timeout;
+	double usecs;
+};
+
+/*
+ * As gpio_wait_edge() but on a libuv worker thread, calling cb(err, usecs)
+ * once the edge has arrived or the wait has timed out.
+ */
+NAN_METHOD(gpio_wait_edge_async)
+{
+	ASSERT_ARGC4(IS_U32, IS_U32, IS_U32, IS_FUNC);
+
+	if (soctype != RPIO_SOC_BCM2835)
+		return ThrowError("Edge waits are only supported on bcm2835");
+
+	pthread_mutex_lock(&edge_lock);
+	edge_pending++;
+	pthread_mutex_unlock(&edge_lock);
+
+	Nan::AsyncQueueWorker(new EdgeWorker(
+	    new Nan::Callback(info[3].As<v8::Function>()),
+	    FROM_U32(0), FROM_U32(1), FROM_U32(2)));
+}
+
+/*
+ * Wait for any async edge waits to finish, including those still queued.
+ */
+static void
+edge_drain(void)
+{
+	pthread_mutex_lock(&edge_lock);
+	edge_closing = 1;
+	while (edge_pending)
+		pthread_cond_wait(&edge_cond, &edge_lock);
+	edge_closing = 0;
+	pthread_mutex_unlock(&edge_lock);
+}
+
+/*
+ * Streaming output.  JS feeds bytes into a single-producer single-consumer
+ * ring from a Writable stream, and a drain thread plays them out.  When the
+ * ring fills, JS asks to be told when it is half empty again and holds off
+ * the stream callback until then, providing backpressure.  Once JS has ended
+ * the stream and the ring has been played out, JS is told that the stream
+ * has finished, along with the number of underruns seen.
+ *
+ * There are two kinds of stream, each with its own ring and drain thread,
+ * and each limited to one at a time: GPIO streams and PWM FIFO streams.
+ */
+#define STREAM_RING_SIZE	65536	/* Must be a power of two */
+
+struct stream_ring;
+
+struct stream_handle {
+	uv_async_t async;
+	Nan::Callback *cb;
+	Nan::AsyncResource *resource;
+	struct stream_ring *ring;
+};
+
+struct stream_ring {
+	uint8_t buf[STREAM_RING_SIZE];
+	uint32_t head;		/* Only written by the event loop */
+	uint32_t tail;		/* Only written by the drain thread */
+	uint32_t want;
+	uint32_t ending;
+	uint32_t finished;
+	uint32_t underruns;
+	uint32_t running;
+	pthread_t thread;
+	struct stream_handle *handle;
+};
+
+static struct stream_ring gpio_stream;
+static struct stream_ring pwm_stream;
+
+/*
+ * Called by a drain thread on each pass to wake JS if it is waiting for
+ * space and the ring is now at most half full.
+ */
+static void
+stream_check_want(struct stream_ring *ring, uint32_t head, uint32_t tail)
+{
+	if (__atomic_load_n(&ring->want, __ATOMIC_ACQUIRE) &&
+	    head - tail <= STREAM_RING_SIZE / 2) {
+		__atomic_store_n(&ring->want, 0, __ATOMIC_RELAXED);
+		uv_async_send(&ring->handle->async);
+	}
+}
+
+/*
+ * Called by a drain thread when the ring is empty.  If the stream has been
+ * ended, tell JS that it has finished and return true for the thread to exit.
+ */
+static bool
+stream_check_end(struct stream_ring *ring)
+{
+	if (!__atomic_load_n(&ring->ending, __ATOMIC_ACQUIRE))
+		return false;
+
+	__atomic_store_n(&ring->finished, 1, __ATOMIC_RELEASE);
+	uv_async_send(&ring->handle->async);
+	return true;
+}
+
+/*
+ * Tell JS either that there is space in the ring again, or that the stream
+ * has been ended and everything queued has been played, along with the
+ * number of underruns so far.
+ */
+static NAUV_WORK_CB(stream_notify)
+{
+	Nan::HandleScope scope;
+	struct stream_handle *handle;
+	struct stream_ring *ring;
+
+	handle = reinterpret_cast<struct stream_handle *>(async->data);
+	ring = handle->ring;
+
+	v8::Local<v8::Value> argv[] = {
+		Nan::New<v8::Boolean>(__atomic_load_n(&ring->finished,
+		    __ATOMIC_ACQUIRE) != 0),
+		Nan::New<v8::Uint32>(__atomic_load_n(&ring->underruns,
+		    __ATOMIC_RELAXED)),
+	};
+	handle->cb->Call(2, argv, handle->resource);
+}
+
+/*
+ * The callback and its resource are released along with the handle rather
+ * than in stream_stop(), as the stream may well be closed from inside its
+ * own callback.
+ */
+static void
+stream_close_cb(uv_handle_t *handle)
+{
+	struct stream_handle *sh;
+
+	sh = reinterpret_cast<struct stream_handle *>(handle->data);
+	delete sh->cb;
+	delete sh->resource;
+	delete sh;
+}
+
+static void
+stream_stop(struct stream_ring *ring)
+{
+	if (!ring->running)
+		return;
+
+	__atomic_store_n(&ring->running, 0, __ATOMIC_RELEASE);
+	pthread_join(ring->thread, NULL);
+
+	uv_close(reinterpret_cast<uv_handle_t *>(&ring->handle->async),
+	    stream_close_cb);
+	ring->handle = NULL;
+}
+
+static bool
+stream_start(struct stream_ring *ring, v8::Local<v8::Function> cb,
+    void *(*drain)(void *))
+{
+	ring->head = ring->tail = 0;
+	ring->want = ring->ending = ring->finished = ring->underruns = 0;
+
+	ring->handle = new struct stream_handle;
+	uv_async_init(GetCurrentEventLoop(), &ring->handle->async,
+	    stream_notify);
+	ring->handle->async.data = ring->handle;
+	ring->handle->cb = new Nan::Callback(cb);
+	ring->handle->resource = new Nan::AsyncResource("rpio:stream");
+	ring->handle->ring = ring;
+
+	ring->running = 1;
+	if (pthread_create(&ring->thread, NULL, drain, ring) != 0) {
+		ring->running = 0;
+		uv_close(reinterpret_cast<uv_handle_t *>(&ring->handle->async),
+		    stream_close_cb);
+		ring->handle = NULL;
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Copy as much of buf[offset..len] into the ring as will fit, returning the
+ * number of bytes accepted.  If not everything fit, the caller will be
+ * notified once the ring is half empty.
+ */
+static void
+stream_write(struct stream_ring *ring,
+    const Nan::FunctionCallbackInfo<v8::Value> &info)
+{
+	ASSERT_ARGC3(IS_OBJ, IS_U32, IS_U32);
+
+	char *buf = FROM_OBJ(0);
+	uint32_t offset = FROM_U32(1);
+	uint32_t buflen = FROM_U32(2);
+	uint32_t head, tail, count, chunk;
+
+	if (!ring->running)
+		return ThrowError("Stream is not open");
+	if (offset > buflen)
+		return ThrowRangeError("Offset beyond end of buffer");
+
+	head = ring->head;
+	tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	count = std::min(buflen - offset, STREAM_RING_SIZE - (head - tail));
+
+	for (uint32_t done = 0; done < count; done += chunk) {
+		chunk = std::min(count - done,
+		    STREAM_RING_SIZE - ((head + done) & (STREAM_RING_SIZE - 1)));
+		memcpy(&ring->buf[(head + done) & (STREAM_RING_SIZE - 1)],
+		    buf + offset + done, chunk);
+	}
+	__atomic_store_n(&ring->head, head + count, __ATOMIC_RELEASE);
+
+	if (count < buflen - offset)
+		__atomic_store_n(&ring->want, 1, __ATOMIC_RELEASE);
+
+	NAN_RETURN(count);
+}
+
+/*
+ * GPIO streams play one byte per sample at a fixed rate, with bit n driving
+ * the n'th pin.  Each byte is looked up in a table of precomputed GPIO words
+ * so that every sample is a single GPSET/GPCLR store pair.  If the ring runs
+ * dry the pins hold their last value, the underrun is counted, and timing
+ * restarts from the next sample to arrive.
+ */
+static uint32_t gpio_stream_table[256];
+static uint32_t gpio_stream_gpiomask;
+static uint8_t gpio_stream_bank;
+static uint32_t gpio_stream_rate;
+
+static void *
+gpio_stream_drain(void *arg)
+{
+	struct stream_ring *ring = (struct stream_ring *)arg;
+	struct timespec ts;
+	uint32_t head, tail, start = 0, n = 0, idle;
+	uint8_t starved = 1;
+
+	/* Sleep for a sample period while starved, 1s at the lowest rate. */
+	idle = std::max(1000000 / gpio_stream_rate, (uint32_t)50);
+	ts.tv_sec = idle / 1000000;
+	ts.tv_nsec = (idle % 1000000) * 1000;
+
+	while (__atomic_load_n(&ring->running, __ATOMIC_ACQUIRE)) {
+		head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		tail = ring->tail;
+
+		stream_check_want(ring, head, tail);
+
+		if (head == tail) {
+			if (stream_check_end(ring))
+				break;
+			if (!starved) {
+				starved = 1;
+				__atomic_fetch_add(&ring->underruns, 1,
+				    __ATOMIC_RELAXED);
+			}
+			nanosleep(&ts, NULL);
+			continue;
+		}
+
+		if (starved) {
+			starved = 0;
+			start = rpio_timestamp32();
+			n = 0;
+		}
+
+		rpio_wait_until(rpio_deadline(start, n++, gpio_stream_rate));
+		bcm2835_gpio_write_mask_bank(gpio_stream_bank,
+		    gpio_stream_table[ring->buf[tail & (STREAM_RING_SIZE - 1)]],
+		    gpio_stream_gpiomask);
+		__atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+	}
+
+	return NULL;
+}
+
+/*
+ * Open a stream on up to 8 pins in a single bank, passed as a Uint32Array of
+ * bit offsets within the bank, played at "rate" samples per second.
+ */
+NAN_METHOD(gpio_stream_open)
+{
+	ASSERT_ARGC4(IS_U32, IS_U32A, IS_U32, IS_FUNC);
+
+	Nan::TypedArrayContents<uint32_t> gpios(info[1]);
+	uint8_t bank = FROM_U32(0);
+	uint32_t rate = FROM_U32(2);
+	uint32_t i, b, word;
+
+	if (soctype != RPIO_SOC_BCM2835)
+		return ThrowError("Streams are only supported on bcm2835");
+	if (gpio_stream.running)
+		return ThrowError("A stream is already open");
+	if (bank > RPIO_PORT_BANK1)
+		return ThrowRangeError("Invalid bank");
+	if (gpios.length() == 0 || gpios.length() > 8)
+		return ThrowRangeError("Streams support 1 to 8 pins");
+	if (rate == 0 || rate > 1000000)
+		return ThrowRangeError("Sample rate must be 1Hz - 1MHz");
+
+	gpio_stream_gpiomask = 0;
+	for (i = 0; i < gpios.length(); i++)
+		gpio_stream_gpiomask |= (1 << ((*gpios)[i] & 0x1f));
+
+	for (b = 0; b < 256; b++) {
+		word = 0;
+		for (i = 0; i < gpios.length(); i++) {
+			if (b & (1 << i))
+				word |= (1 << ((*gpios)[i] & 0x1f));
+		}
+		gpio_stream_table[b] = word;
+	}
+
+	gpio_stream_bank = bank;
+	gpio_stream_rate = rate;
+
+	if (!stream_start(&gpio_stream, info[3].As<v8::Function>(),
+	    gpio_stream_drain))
+		return ThrowError("Could not start stream thread");
+}
+
+NAN_METHOD(gpio_stream_write)
+{
+	stream_write(&gpio_stream, info);
+}
+
+/*
+ * No more data is coming, so finish once the ring has been played out.
+ */
+NAN_METHOD(gpio_stream_end)
+{
+	__atomic_store_n(&gpio_stream.ending, 1, __ATOMIC_RELEASE);
+}
+
+NAN_METHOD(gpio_stream_close)
+{
+	stream_stop(&gpio_stream);
+}
+
+/*
+ * PWM FIFO streams feed little-endian 32-bit words from the ring into the
+ * PWM FIFO, which the hardware then clocks out with no further CPU timing.
+ * The FIFO is only a few words deep, so the thread polls the FULL1 flag
+ * every PWM_STREAM_POLL microseconds while it has data to write, and counts
+ * an underrun whenever the hardware has flagged a read from an empty FIFO
+ * before the stream has been ended.
+ * Once an ended stream has been written out, the thread waits for the FIFO
+ * to empty before reporting that the stream has finished.
+ */
+#define PWM_STREAM_POLL		50	/* usecs */
+
+static uint8_t pwm_stream_channel;
+
+static void *
+pwm_stream_drain(void *arg)
+{
+	struct stream_ring *ring = (struct stream_ring *)arg;
+	struct timespec ts = { 0, PWM_STREAM_POLL * 1000 };
+	uint32_t head, tail, word, status;
+	uint8_t i;
+
+	while (__atomic_load_n(&ring->running, __ATOMIC_ACQUIRE)) {
+		head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		tail = ring->tail;
+
+		stream_check_want(ring, head, tail);
+
+		status = bcm2835_pwm_status();
+		if (status & BCM2835_PWM_STA_RERR1) {
+			bcm2835_pwm_clear_status(BCM2835_PWM_STA_RERR1);
+			if (tail != 0 && !__atomic_load_n(&ring->ending,
+			    __ATOMIC_ACQUIRE))
+				__atomic_fetch_add(&ring->underruns, 1,
+				    __ATOMIC_RELAXED);
+		}
+
+		/* Any trailing partial word is discarded. */
+		if (head - tail < 4) {
+			if ((status & BCM2835_PWM_STA_EMPT1) &&
+			    stream_check_end(ring))
+				break;
+			nanosleep(&ts, NULL);
+			continue;
+		}
+
+		if (status & BCM2835_PWM_STA_FULL1) {
+			nanosleep(&ts, NULL);
+			continue;
+		}
+
+		for (word = 0, i = 0; i < 4; i++)
+			word |= (uint32_t)ring->buf[(tail + i) &
+			    (STREAM_RING_SIZE - 1)] << (i * 8);
+		bcm2835_pwm_fifo_write(word);
+		__atomic_store_n(&ring->tail, tail + 4, __ATOMIC_RELEASE);
+	}
+
+	bcm2835_pwm_set_fifo_mode(pwm_stream_channel, 0, 0);
+
+	return NULL;
+}
+
+/*
+ * Open a PWM FIFO stream on a channel, either in serialiser mode or with
+ * each word used as the data value for one PWM period.  The clock and range
+ * should already have been set up.
+ */
+NAN_METHOD(pwm_stream_open)
+{
+	ASSERT_ARGC3(IS_U32, IS_U32, IS_FUNC);
+
+	uint32_t channel = FROM_U32(0);
+	uint32_t serial = FROM_U32(1);
+
+	if (soctype != RPIO_SOC_BCM2835)
+		return ThrowError("PWM streams are only supported on bcm2835");
+	if (pwm_stream.running)
+		return ThrowError("A PWM stream is already open");
+	if (channel > 1)
+		return ThrowRangeError("Invalid PWM channel");
+
+	pwm_stream_channel = channel;
+	bcm2835_pwm_set_fifo_mode(channel, serial, 1);
+	bcm2835_pwm_clear_status(BCM2835_PWM_STA_WERR1 |
+	    BCM2835_PWM_STA_RERR1 | BCM2835_PWM_STA_BERR);
+
+	if (!stream_start(&pwm_stream, info[2].As<v8::Function>(),
+	    pwm_stream_drain)) {
+		bcm2835_pwm_set_fifo_mode(channel, 0, 0);
+		return ThrowError("Could not start PWM stream thread");
+	}
+}
+
+NAN_METHOD(pwm_stream_write)
+{
+	stream_write(&pwm_stream, info);
+}
+
+NAN_METHOD(pwm_stream_end)
+{
+	__atomic_store_n(&pwm_stream.ending, 1, __ATOMIC_RELEASE);
+}
+
+NAN_METHOD(pwm_stream_close)
+{
+	stream_stop(&pwm_stream);
+}
+
+/*
+ * Deadline scheduler.  Actions are queued with an absolute system timer
+ * deadline in a min-heap, and a scheduler thread sleeps on a condition
+ * variable until shortly before the earliest one is due, then spins the rest
+ * of the way with rpio_wait_until() for accuracy.  The heap is rechecked on
+ * every wakeup, so an action queued ahead of the current earliest is picked
+ * up straight away.
+ *
+ * Completed actions are passed back in batches to the event loop as a
+ * Uint32Array of [id, lateness] pairs.  Captures run to completion on the
+ * scheduler thread, so actions due during a capture will run late.
+ */
+#define SCHED_WRITE		0x1
+#define SCHED_TOGGLE		0x2
+#define SCHED_CAPTURE		0x3
+
+struct sched_action {
+	uint64_t deadline;
+	uint32_t id;
+	uint8_t op;
+	uint8_t bank;
+	uint32_t value;
+	uint32_t mask;
+	uint32_t *words;
+	uint32_t count;
+	uint32_t rate;
+};
+
+/* Earliest deadline first, and in order of submission for equal deadlines. */
+struct sched_later {
+	bool operator()(const struct sched_action &a,
+	    const struct sched_action &b) const
+	{
+		if (a.deadline != b.deadline)
+			return a.deadline > b.deadline;
+		return a.id > b.id;
+	}
+};
+
+static std::vector<struct sched_action> sched_heap;
+static std::vector<uint32_t> sched_done;
+static pthread_mutex_t sched_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sched_cond;
+
+static pthread_t sched_thread;
+static uv_async_t *sched_async;
+static Nan::Callback *sched_cb;
+static Nan::AsyncResource *sched_resource;
+static uint32_t sched_running;
+static uint32_t sched_pending;
+
+static void
+sched_run(struct sched_action *action)
+{
+	uint32_t i, start;
+
+	switch (action->op) {
+	case SCHED_WRITE:
+		bcm2835_gpio_write_mask_bank(action->bank, action->value,
+		    action->mask);
+		break;
+	case SCHED_TOGGLE:
+		bcm2835_gpio_write_mask_bank(action->bank,
+		    ~bcm2835_gpio_lev_bank(action->bank), action->mask);
+		break;
+	case SCHED_CAPTURE:
+		start = rpio_timestamp32();
+		for (i = 0; i < action->count; i++) {
+			rpio_wait_until(rpio_deadline(start, i, action->rate));
+			action->words[i] = bcm2835_gpio_lev_bank(action->bank);
+		}
+		break;
+	}
+}
+
+static void *
+sched_main(void *arg)
+{
+	struct sched_action action;
+	struct timespec ts;
+	int64_t remain;
+	uint32_t late;
+
+	pthread_mutex_lock(&sched_lock);
+	while (sched_running) {
+		if (sched_heap.empty()) {
+			pthread_cond_wait(&sched_cond, &sched_lock);
+			continue;
+		}
+
+		remain = (int64_t)(sched_heap.front().deadline -
+		    rpio_timestamp());
+		if (remain > 450) {
+			remain -= 200;
+			clock_gettime(CLOCK_MONOTONIC, &ts);
+			ts.tv_sec += remain / 1000000;
+			ts.tv_nsec += (remain % 1000000) * 1000;
+			if (ts.tv_nsec >= 1000000000) {
+				ts.tv_sec++;
+				ts.tv_nsec -= 1000000000;
+			}
+			pthread_cond_timedwait(&sched_cond, &sched_lock, &ts);
+			continue;
+		}
+
+		std::pop_heap(sched_heap.begin(), sched_heap.end(),
+		    sched_later());
+		action = sched_heap.back();
+		sched_heap.pop_back();
+		pthread_mutex_unlock(&sched_lock);
+
+		late = rpio_wait_until((uint32_t)action.deadline);
+		sched_run(&action);
+
+		pthread_mutex_lock(&sched_lock);
+		sched_done.push_back(action.id);
+		sched_done.push_back(late);
+		uv_async_send(sched_async);
+	}
+	pthread_mutex_unlock(&sched_lock);
+
+	return NULL;
+}
+
+/*
+ * As with ramps, the async handle only holds the event loop open while
+ * there are actions which have not yet been delivered, counting those the
+ * thread has already picked up.  Only called from the event loop thread.
+ */
+static void
+sched_update_ref(void)
+{
+	if (sched_pending)
+		uv_ref(reinterpret_cast<uv_handle_t *>(sched_async));
+	else
+		uv_unref(reinterpret_cast<uv_handle_t *>(sched_async));
+}
+
+static NAUV_WORK_CB(sched_deliver)
+{
+	Nan::HandleScope scope;
+	std::vector<uint32_t> done;
+
+	pthread_mutex_lock(&sched_lock);
+	done.swap(sched_done);
+	pthread_mutex_unlock(&sched_lock);
+
+	sched_pending -= done.size() / 2;
+	sched_update_ref();
+
+	if (done.empty())
+		return;
+
+	v8::Local<v8::ArrayBuffer> ab = v8::ArrayBuffer::New(
+	    v8::Isolate::GetCurrent(), done.size() * sizeof(uint32_t));
+	v8::Local<v8::Uint32Array> ids =
+	    v8::Uint32Array::New(ab, 0, done.size());
+	Nan::TypedArrayContents<uint32_t> contents(ids);
+	memcpy(*contents, &done[0], done.size() * sizeof(uint32_t));
+
+	v8::Local<v8::Value> argv[] = { ids };
+	sched_cb->Call(1, argv, sched_resource);
+}
+
+static void
+sched_close_cb(uv_handle_t *handle)
+{
+	delete reinterpret_cast<uv_async_t *>(handle);
+}
+
+static void
+sched_stop(void)
+{
+	if (!sched_running)
+		return;
+
+	pthread_mutex_lock(&sched_lock);
+	sched_running = 0;
+	pthread_cond_signal(&sched_cond);
+	pthread_mutex_unlock(&sched_lock);
+	pthread_join(sched_thread, NULL);
+	pthread_cond_destroy(&sched_cond);
+
+	uv_close(reinterpret_cast<uv_handle_t *>(sched_async), sched_close_cb);
+	sched_async = NULL;
+
+	delete sched_cb;
+	delete sched_resource;
+	sched_cb = NULL;
+	sched_resource = NULL;
+	sched_heap.clear();
+	sched_done.clear();
+	sched_pending = 0;
+}
+
+static void
+sched_add(struct sched_action *action)
+{
+	pthread_mutex_lock(&sched_lock);
+	sched_heap.push_back(*action);
+	std::push_heap(sched_heap.begin(), sched_heap.end(), sched_later());
+	pthread_cond_signal(&sched_cond);
+	pthread_mutex_unlock(&sched_lock);
+
+	sched_pending++;
+	sched_update_ref();
+}
+
+/*
+ * Start the scheduler thread, with cb receiving completed actions.
+ */
+NAN_METHOD(gpio_sched_start)
+{
+	ASSERT_ARGC1(IS_FUNC);
+
+	pthread_condattr_t attr;
+
+	if (soctype != RPIO_SOC_BCM2835)
+		return ThrowError("Scheduling is only supported on bcm2835");
+	if (sched_running)
+		return;
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&sched_cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	sched_async = new uv_async_t;
+	uv_async_init(GetCurrentEventLoop(), sched_async, sched_deliver);
+	uv_unref(reinterpret_cast<uv_handle_t *>(sched_async));
+	sched_cb = new Nan::Callback(info[0].As<v8::Function>());
+	sched_resource = new Nan::AsyncResource("rpio:sched");
+
+	sched_running = 1;
+	if (pthread_create(&sched_thread, NULL, sched_main, NULL) != 0) {
+		sched_running = 0;
+		pthread_cond_destroy(&sched_cond);
+		uv_close(reinterpret_cast<uv_handle_t *>(sched_async),
+		    sched_close_cb);
+		delete sched_cb;
+		delete sched_resource;
+		return ThrowError("Could not start scheduler thread");
+	}
+}
+
+/*
+ * Queue a write or toggle of the pins in "mask" within a single bank.
+ */
+NAN_METHOD(gpio_sched_write)
+{
+	ASSERT_ARGC6(IS_U32, IS_NUM, IS_U32, IS_U32, IS_U32, IS_U32);
+
+	struct sched_action action = {};
+
+	if (!sched_running)
+		return ThrowError("Scheduler is not running");
+	if (FROM_U32(3) > RPIO_PORT_BANK1)
+		return ThrowRangeError("Invalid bank");
+
+	action.id = FROM_U32(0);
+	action.deadline = (uint64_t)FROM_NUM(1);
+	action.op = FROM_U32(2) ? SCHED_TOGGLE : SCHED_WRITE;
+	action.bank = FROM_U32(3);
+	action.value = FROM_U32(4);
+	action.mask = FROM_U32(5);
+
+	sched_add(&action);
 }
 
-NAN_METHOD(gpio_event_poll)
+/*
+ * Queue a capture of "count" samples of a bank into "words" at "rate".  The
+ * caller must keep the array alive until the capture completes.
+ */
+NAN_METHOD(gpio_sched_capture)
+{
+	ASSERT_ARGC6(IS_U32, IS_NUM, IS_U32, IS_U32A, IS_U32, IS_U32);
+
+	Nan::TypedArrayContents<uint32_t> words(info[3]);
+	struct sched_action action = {};
+
+	if (!sched_running)
+		return ThrowError("Scheduler is not running");
+	if (FROM_U32(2) > RPIO_PORT_BANK1)
+		return ThrowRangeError("Invalid bank");
+	if (FROM_U32(4) > words.length())
+		return ThrowRangeError("Array not large enough for request");
+	if (FROM_U32(5) == 0 || FROM_U32(5) > 1000000)
+		return ThrowRangeError("Sample rate must be 1Hz - 1MHz");
+
+	action.id = FROM_U32(0);
+	action.deadline = (uint64_t)FROM_NUM(1);
+	action.op = SCHED_CAPTURE;
+	action.bank = FROM_U32(2);
+	action.words = *words;
+	action.count = FROM_U32(4);
+	action.rate = FROM_U32(5);
+
+	sched_add(&action);
+}
+
+/*
+ * Remove a pending action, returning whether it was found.  An action which
+ * the thread has already picked up will still run.
+ */
+NAN_METHOD(gpio_sched_cancel)
 {
 	ASSERT_ARGC1(IS_U32);
 
-	uint32_t rval = 0;
-	uint32_t mask = FROM_U32(0);
+	uint32_t id = FROM_U32(0);
+	bool found = false;
+
+	pthread_mutex_lock(&sched_lock);
+	for (size_t i = 0; i < sched_heap.size(); i++) {
+		if (sched_heap[i].id == id) {
+			sched_heap.erase(sched_heap.begin() + i);
+			std::make_heap(sched_heap.begin(), sched_heap.end(),
+			    sched_later());
+			found = true;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&sched_lock);
 
-	/*
-	 * Interrupts are not supported, so this merely reports that an event
-	 * happened in the time period since the last poll.  There is no way to
-	 * know which trigger caused the event.
-	 */
-	if ((rval = bcm2835_gpio_eds_multi(mask))) {
-		bcm2835_gpio_set_eds_multi(rval);
+	if (found) {
+		sched_pending--;
+		sched_update_ref();
 	}
 
-	NAN_RETURN(rval);
+	NAN_RETURN(found);
 }
 
-NAN_METHOD(gpio_event_clear)
+NAN_METHOD(gpio_sched_stop)
 {
-	ASSERT_ARGC1(IS_U32);
-
-	uint32_t pin = FROM_U32(0);
-
-	bcm2835_gpio_clr_fen(pin);
-	bcm2835_gpio_clr_ren(pin);
+	sched_stop();
 }
 
 /*
@@ -395,13 +2111,79 @@ NAN_METHOD(i2c_write)
 /*
  * PWM functions
  */
+/*
+ * Reprogramming the PWM clock involves stopping it and sleeping for 110ms, so
+ * skip it if the clock is already running with the requested divisor.
+ *
+ * As this may run on a worker thread, the check and update are done under
+ * pwm_clock_lock so that concurrent sync and async calls do not interleave,
+ * and async calls are counted so that rpio_close() can wait for them before
+ * the clock manager is unmapped.
+ */
+static pthread_mutex_t pwm_clock_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pwm_clock_cond = PTHREAD_COND_INITIALIZER;
+static uint32_t pwm_clock_pending;
+
+static void
+pwm_clock_set(uint32_t divisor)
+{
+	pthread_mutex_lock(&pwm_clock_lock);
+	if (divisor == 0 || bcm2835_pwm_get_clock() != (divisor & 0xfff))
+		bcm2835_pwm_set_clock(divisor);
+	pthread_mutex_unlock(&pwm_clock_lock);
+}
+
+static void
+pwm_clock_drain(void)
+{
+	pthread_mutex_lock(&pwm_clock_lock);
+	while (pwm_clock_pending)
+		pthread_cond_wait(&pwm_clock_cond, &pwm_clock_lock);
+	pthread_mutex_unlock(&pwm_clock_lock);
+}
+
 NAN_METHOD(pwm_set_clock)
 {
 	ASSERT_ARGC1(IS_U32);
 
 	uint32_t divisor = FROM_U32(0);
 
-	bcm2835_pwm_set_clock(divisor);
+	pwm_clock_set(divisor);
+}
+
+class PwmClockWorker : public Nan::AsyncWorker {
+public:
+	PwmClockWorker(Nan::Callback *callback, uint32_t divisor)
+	    : Nan::AsyncWorker(callback, "rpio:pwmclock"), divisor(divisor) {}
+
+	void Execute()
+	{
+		pwm_clock_set(divisor);
+
+		pthread_mutex_lock(&pwm_clock_lock);
+		pwm_clock_pending--;
+		pthread_cond_broadcast(&pwm_clock_cond);
+		pthread_mutex_unlock(&pwm_clock_lock);
+	}
+
+private:
+	uint32_t divisor;
+};
+
+/*
+ * As pwm_set_clock() but on a libuv worker thread, calling cb(err) once the
+ * clock has been reprogrammed.
+ */
+NAN_METHOD(pwm_set_clock_async)
+{
+	ASSERT_ARGC2(IS_U32, IS_FUNC);
+
+	pthread_mutex_lock(&pwm_clock_lock);
+	pwm_clock_pending++;
+	pthread_mutex_unlock(&pwm_clock_lock);
+
+	Nan::AsyncQueueWorker(new PwmClockWorker(
+	    new Nan::Callback(info[1].As<v8::Function>()), FROM_U32(0)));
 }
 
 NAN_METHOD(pwm_set_mode)
@@ -435,6 +2217,787 @@ NAN_METHOD(pwm_set_data)
 	bcm2835_pwm_set_data(channel, data);
 }
 
+/*
+ * Set both channels' data together.  The PWM block has no status flag for
+ * the end of a period, so if "gpio" is a valid pin, first wait up to
+ * "timeout" usecs for a rising edge on it, which in mark-space mode is the
+ * start of a period, to give the writes a full period to land in.  Balanced
+ * mode spreads several pulses through each period, so its edges say nothing
+ * about where a period starts.  Returns whether an edge was seen.
+ */
+NAN_METHOD(pwm_set_data_pair)
+{
+	ASSERT_ARGC4(IS_U32, IS_U32, IS_U32, IS_U32);
+
+	uint32_t gpio = FROM_U32(2);
+	uint32_t timeout = FROM_U32(3);
+	uint32_t start, bit;
+	bool low = false, synced = false;
+
+	if (soctype != RPIO_SOC_BCM2835)
+		return ThrowError("PWM data pairs are only supported on bcm2835");
+
+	if (gpio <= 53) {
+		bit = 1 << (gpio & 31);
+		start = rpio_timestamp32();
+		while (rpio_timestamp32() - start < timeout) {
+			if (!(bcm2835_gpio_lev_bank(gpio >> 5) & bit)) {
+				low = true;
+			} else if (low) {
+				synced = true;
+				break;
+			}
+		}
+	}
+
+	bcm2835_pwm_set_data_pair(FROM_U32(0), FROM_U32(1));
+
+	NAN_RETURN(synced);
+}
+
+/*
+ * PWM planner.  Both channels share one clock, so find the clock divisor and
+ * per-channel range which best hit each channel's target frequency while
+ * giving at least the requested resolution (range).  Checking every legal
+ * divisor is only a few thousand iterations, so it is simply done per call.
+ *
+ * Any divisor which puts every channel within "tolerance" of its target is
+ * acceptable.  The currently running divisor is preferred if acceptable, to
+ * avoid a slow clock restart, otherwise the smallest acceptable divisor is
+ * used as it gives the largest range.  If no divisor is acceptable, use the
+ * one with the lowest worst case error.
+ */
+#define PWM_PLAN_DIV_MIN	2
+#define PWM_PLAN_DIV_MAX	4095
+
+struct pwm_plan_channel {
+	double freq;		/* Target frequency, 0 if unused */
+	double duty;
+	double resolution;
+	uint32_t range;
+	uint32_t data;
+	double actual;
+};
+
+/*
+ * Return the relative error of the best range for a channel at "div", or -1
+ * if the resolution cannot be met.
+ */
+static double
+pwm_plan_range(struct pwm_plan_channel *ch, uint32_t osc, uint32_t div,
+    uint32_t *range)
+{
+	double r = (double)osc / div / ch->freq;
+
+	if (r + 0.5 < ch->resolution || r + 0.5 > UINT32_MAX)
+		return -1;
+
+	*range = (uint32_t)(r + 0.5);
+	return fabs((double)osc / div / *range - ch->freq) / ch->freq;
+}
+
+static double
+pwm_plan_error(struct pwm_plan_channel *chs, uint32_t osc, uint32_t div)
+{
+	uint32_t range;
+	double err, worst = 0;
+
+	for (uint8_t i = 0; i < 2; i++) {
+		if (chs[i].freq == 0)
+			continue;
+		if ((err = pwm_plan_range(&chs[i], osc, div, &range)) < 0)
+			return -1;
+		worst = std::max(worst, err);
+	}
+
+	return worst;
+}
+
+static uint32_t
+pwm_plan(struct pwm_plan_channel *chs, double tolerance)
+{
+	uint32_t osc = bcm2835_osc_freq();
+	uint32_t div, best = 0;
+	double err, besterr = -1;
+
+	div = bcm2835_pwm_get_clock();
+	if (div >= PWM_PLAN_DIV_MIN &&
+	    (err = pwm_plan_error(chs, osc, div)) >= 0 && err <= tolerance) {
+		best = div;
+	} else {
+		for (div = PWM_PLAN_DIV_MIN; div <= PWM_PLAN_DIV_MAX; div++) {
+			if ((err = pwm_plan_error(chs, osc, div)) < 0)
+				continue;
+			if (err <= tolerance) {
+				best = div;
+				break;
+			}
+			if (besterr < 0 || err < besterr) {
+				besterr = err;
+				best = div;
+			}
+		}
+	}
+
+	if (!best)
+		return 0;
+
+	for (uint8_t i = 0; i < 2; i++) {
+		if (chs[i].freq == 0)
+			continue;
+		pwm_plan_range(&chs[i], osc, best, &chs[i].range);
+		chs[i].data = (uint32_t)(chs[i].range * chs[i].duty + 0.5);
+		chs[i].actual = (double)osc / best / chs[i].range;
+	}
+
+	return best;
+}
+
+/*
+ * Plan, and if "apply" is set program, both PWM channels in one call.
+ * "params" holds [freq, duty, resolution] for each channel followed by the
+ * tolerance, and "out" receives [range, data, actual frequency] for each
+ * channel.  Returns the divisor, or 0 if no divisor meets the resolutions.
+ */
+NAN_METHOD(pwm_configure)
+{
+	ASSERT_ARGC3(IS_F64A, IS_F64A, IS_U32);
+
+	Nan::TypedArrayContents<double> params(info[0]);
+	Nan::TypedArrayContents<double> out(info[1]);
+	struct pwm_plan_channel chs[2] = {};
+	uint32_t divisor;
+
+	if (params.length() < 7 || out.length() < 6)
+		return ThrowRangeError("Array not large enough for request");
+
+	for (uint8_t i = 0; i < 2; i++) {
+		chs[i].freq = (*params)[i * 3];
+		chs[i].duty = (*params)[i * 3 + 1];
+		chs[i].resolution = (*params)[i * 3 + 2];
+	}
+
+	if ((divisor = pwm_plan(chs, (*params)[6])) == 0) {
+		NAN_RETURN(0);
+		return;
+	}
+
+	for (uint8_t i = 0; i < 2; i++) {
+		(*out)[i * 3] = chs[i].range;
+		(*out)[i * 3 + 1] = chs[i].data;
+		(*out)[i * 3 + 2] = chs[i].actual;
+	}
+
+	if (FROM_U32(2)) {
+		pwm_clock_set(divisor);
+		for (uint8_t i = 0; i < 2; i++) {
+			if (chs[i].freq == 0)
+				continue;
+			bcm2835_pwm_set_range(i, chs[i].range);
+			bcm2835_pwm_set_data(i, chs[i].data);
+		}
+	}
+
+	NAN_RETURN(divisor);
+}
+
+/*
+ * PWM ramps.  A background thread steps each hardware PWM channel from one
+ * data value to another over a given duration, shaped by an easing curve,
+ * updating every RAMP_STEP microseconds and only writing when the value has
+ * actually changed.  Completed ramps are passed back to the event loop as a
+ * Uint32Array of ramp ids so that JS can run their callbacks.
+ */
+#define RAMP_STEP		1000	/* usecs */
+#define RAMP_CHANNELS		2
+
+#define RAMP_LINEAR		0x0
+#define RAMP_EASE_IN		0x1
+#define RAMP_EASE_OUT		0x2
+#define RAMP_EASE_IN_OUT	0x3
+
+struct ramp_channel {
+	uint8_t active;
+	uint8_t curve;
+	uint32_t id;
+	uint32_t from;
+	uint32_t to;
+	uint32_t last;
+	uint64_t start;
+	uint32_t duration;
+};
+
+static struct ramp_channel ramp_channels[RAMP_CHANNELS];
+static std::vector<uint32_t> ramp_done;
+static pthread_mutex_t ramp_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ramp_cond;
+
+static pthread_t ramp_thread;
+static uv_async_t *ramp_async;
+static Nan::Callback *ramp_cb;
+static Nan::AsyncResource *ramp_resource;
+static uint32_t ramp_running;
+
+static double
+ramp_ease(uint8_t curve, double t)
+{
+	switch (curve) {
+	case RAMP_EASE_IN:
+		return t * t;
+	case RAMP_EASE_OUT:
+		return t * (2 - t);
+	case RAMP_EASE_IN_OUT:
+		return (t < 0.5) ? 2 * t * t : -1 + (4 - 2 * t) * t;
+	default:
+		return t;
+	}
+}
+
+static void *
+ramp_main(void *arg)
+{
+	struct ramp_channel *rc;
+	struct timespec ts;
+	uint32_t value;
+	uint64_t elapsed;
+	uint8_t channel, any;
+	double t;
+
+	pthread_mutex_lock(&ramp_lock);
+	while (ramp_running) {
+		any = 0;
+
+		for (channel = 0; channel < RAMP_CHANNELS; channel++) {
+			rc = &ramp_channels[channel];
+			if (!rc->active)
+				continue;
+
+			elapsed = rpio_timestamp() - rc->start;
+			if (elapsed >= rc->duration) {
+				value = rc->to;
+				rc->active = 0;
+			} else {
+				t = ramp_ease(rc->curve,
+				    (double)elapsed / rc->duration);
+				value = rc->from + (int64_t)(((double)rc->to -
+				    rc->from) * t + 0.5);
+				any = 1;
+			}
+
+			if (value != rc->last) {
+				bcm2835_pwm_set_data(channel, value);
+				rc->last = value;
+			}
+
+			if (!rc->active) {
+				ramp_done.push_back(rc->id);
+				uv_async_send(ramp_async);
+			}
+		}
+
+		if (!any) {
+			pthread_cond_wait(&ramp_cond, &ramp_lock);
+			continue;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		ts.tv_nsec += RAMP_STEP * 1000;
+		if (ts.tv_nsec >= 1000000000) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000;
+		}
+		pthread_cond_timedwait(&ramp_cond, &ramp_lock, &ts);
+	}
+	pthread_mutex_unlock(&ramp_lock);
+
+	return NULL;
+}
+
+/*
+ * The async handle only holds the event loop open while a ramp is in
+ * progress, so an idle ramp thread does not stop the process from exiting.
+ * Must be called from the event loop thread with ramp_lock held.
+ */
+static void
+ramp_update_ref(void)
+{
+	uint8_t channel;
+
+	for (channel = 0; channel < RAMP_CHANNELS; channel++) {
+		if (ramp_channels[channel].active) {
+			uv_ref(reinterpret_cast<uv_handle_t *>(ramp_async));
+			return;
+		}
+	}
+	uv_unref(reinterpret_cast<uv_handle_t *>(ramp_async));
+}
+
+static NAUV_WORK_CB(ramp_deliver)
+{
+	Nan::HandleScope scope;
+	std::vector<uint32_t> done;
+
+	pthread_mutex_lock(&ramp_lock);
+	done.swap(ramp_done);
+	ramp_update_ref();
+	pthread_mutex_unlock(&ramp_lock);
+
+	if (done.empty())
+		return;
+
+	v8::Local<v8::ArrayBuffer> ab = v8::ArrayBuffer::New(
+	    v8::Isolate::GetCurrent(), done.size() * sizeof(uint32_t));
+	v8::Local<v8::Uint32Array> ids =
+	    v8::Uint32Array::New(ab, 0, done.size());
+	Nan::TypedArrayContents<uint32_t> contents(ids);
+	memcpy(*contents, &done[0], done.size() * sizeof(uint32_t));
+
+	v8::Local<v8::Value> argv[] = { ids };
+	ramp_cb->Call(1, argv, ramp_resource);
+}
+
+static void
+ramp_close_cb(uv_handle_t *handle)
+{
+	delete reinterpret_cast<uv_async_t *>(handle);
+}
+
+static void
+ramp_stop(void)
+{
+	if (!ramp_running)
+		return;
+
+	pthread_mutex_lock(&ramp_lock);
+	ramp_running = 0;
+	pthread_cond_signal(&ramp_cond);
+	pthread_mutex_unlock(&ramp_lock);
+	pthread_join(ramp_thread, NULL);
+	pthread_cond_destroy(&ramp_cond);
+
+	uv_close(reinterpret_cast<uv_handle_t *>(ramp_async), ramp_close_cb);
+	ramp_async = NULL;
+
+	delete ramp_cb;
+	delete ramp_resource;
+	ramp_cb = NULL;
+	ramp_resource = NULL;
+	memset(ramp_channels, 0, sizeof(ramp_channels));
+	ramp_done.clear();
+}
+
+/*
+ * Start the ramp thread, with cb receiving the ids of completed ramps.
+ */
+NAN_METHOD(pwm_ramp_start)
+{
+	ASSERT_ARGC1(IS_FUNC);
+
+	pthread_condattr_t attr;
+
+	if (ramp_running)
+		return;
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&ramp_cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	ramp_async = new uv_async_t;
+	uv_async_init(GetCurrentEventLoop(), ramp_async, ramp_deliver);
+	uv_unref(reinterpret_cast<uv_handle_t *>(ramp_async));
+	ramp_cb = new Nan::Callback(info[0].As<v8::Function>());
+	ramp_resource = new Nan::AsyncResource("rpio:ramp");
+
+	ramp_running = 1;
+	if (pthread_create(&ramp_thread, NULL, ramp_main, NULL) != 0) {
+		ramp_running = 0;
+		pthread_cond_destroy(&ramp_cond);
+		uv_close(reinterpret_cast<uv_handle_t *>(ramp_async),
+		    ramp_close_cb);
+		delete ramp_cb;
+		delete ramp_resource;
+		return ThrowError("Could not start PWM ramp thread");
+	}
+}
+
+/*
+ * Ramp a channel from one value to another over "duration" usecs, replacing
+ * any ramp already in progress on that channel.
+ */
+NAN_METHOD(pwm_ramp)
+{
+	ASSERT_ARGC6(IS_U32, IS_U32, IS_U32, IS_U32, IS_U32, IS_U32);
+
+	uint32_t channel = FROM_U32(0);
+	struct ramp_channel *rc;
+
+	if (!ramp_running)
+		return ThrowError("PWM ramp thread is not running");
+	if (channel >= RAMP_CHANNELS)
+		return ThrowRangeError("Invalid PWM channel");
+	if (FROM_U32(5) > RAMP_EASE_IN_OUT)
+		return ThrowRangeError("Invalid easing curve");
+
+	pthread_mutex_lock(&ramp_lock);
+	rc = &ramp_channels[channel];
+	rc->id = FROM_U32(1);
+	rc->from = FROM_U32(2);
+	rc->to = FROM_U32(3);
+	rc->duration = FROM_U32(4);
+	rc->curve = FROM_U32(5);
+	rc->start = rpio_timestamp();
+	rc->last = rc->from;
+	rc->active = 1;
+	bcm2835_pwm_set_data(channel, rc->from);
+	ramp_update_ref();
+	pthread_cond_signal(&ramp_cond);
+	pthread_mutex_unlock(&ramp_lock);
+}
+
+/*
+ * Stop any ramp on a channel where it is, returning whether one was active.
+ */
+NAN_METHOD(pwm_ramp_cancel)
+{
+	ASSERT_ARGC1(IS_U32);
+
+	uint32_t channel = FROM_U32(0);
+	bool active = false;
+
+	if (channel >= RAMP_CHANNELS)
+		return ThrowRangeError("Invalid PWM channel");
+
+	pthread_mutex_lock(&ramp_lock);
+	active = ramp_channels[channel].active;
+	ramp_channels[channel].active = 0;
+	if (ramp_running)
+		ramp_update_ref();
+	pthread_mutex_unlock(&ramp_lock);
+
+	NAN_RETURN(active);
+}
+
+/*
+ * Software PWM.  A single thread drives any number of output pins, each with
+ * its own period and high time in microseconds.  On each pass it finds the
+ * earliest pending edge across all channels, and batches it with any other
+ * edges due within SOFTPWM_WINDOW microseconds into one GPSET/GPCLR mask
+ * write per bank, so channels sharing a frequency switch together rather
+ * than as a stream of separate writes.
+ *
+ * Edges are timed from each channel's nominal deadlines rather than from
+ * when they actually happened, so lateness shows up as jitter but not drift.
+ * Changes to a running channel are applied at the start of its next period
+ * so that no partial periods are generated.  As with the scheduler, the
+ * thread sleeps on a condition variable until just before the next edge so
+ * that changes are picked up immediately.
+ */
+#define SOFTPWM_WINDOW		4	/* usecs */
+#define SOFTPWM_CHANNELS	54
+
+struct softpwm_channel {
+	uint8_t active;
+	uint8_t stopping;
+	uint8_t rising;		/* Next edge is the start of a period */
+	uint64_t start;		/* Start of the current period */
+	uint64_t next;		/* Deadline of the next edge */
+	uint32_t period;
+	uint32_t high;
+	uint32_t new_period;	/* Pending config for the next period */
+	uint32_t new_high;
+};
+
+static struct softpwm_channel softpwm_channels[SOFTPWM_CHANNELS];
+static pthread_mutex_t softpwm_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t softpwm_cond;
+static pthread_t softpwm_thread;
+static uint32_t softpwm_running;
+
+/* Lateness statistics since they were last read, in microseconds. */
+static uint32_t softpwm_edges;
+static uint32_t softpwm_late_max;
+static uint64_t softpwm_late_sum;
+
+/*
+ * Advance a channel past its next edge, adding it to the set or clear mask
+ * for its bank.  Called with softpwm_lock held.
+ */
+static void
+softpwm_advance(uint8_t gpio, uint64_t now, uint32_t *set, uint32_t *clr)
+{
+	struct softpwm_channel *ch = &softpwm_channels[gpio];
+	uint32_t bit = 1 << (gpio & 31);
+	uint8_t bank = gpio >> 5;
+
+	if (ch->stopping) {
+		clr[bank] |= bit;
+		ch->active = ch->stopping = 0;
+		return;
+	}
+
+	if (!ch->rising) {
+		clr[bank] |= bit;
+		ch->next = ch->start + ch->period;
+		ch->rising = 1;
+		return;
+	}
+
+	ch->period = ch->new_period;
+	ch->high = ch->new_high;
+	ch->start = ch->next;
+
+	/* Resynchronise rather than trying to catch up after a long stall. */
+	if (ch->start + ch->period < now)
+		ch->start = now;
+
+	if (ch->high == 0) {
+		clr[bank] |= bit;
+		ch->next = ch->start + ch->period;
+	} else if (ch->high >= ch->period) {
+		set[bank] |= bit;
+		ch->next = ch->start + ch->period;
+	} else {
+		set[bank] |= bit;
+		ch->next = ch->start + ch->high;
+		ch->rising = 0;
+	}
+}
+
+static void *
+softpwm_main(void *arg)
+{
+	struct softpwm_channel *ch;
+	struct timespec ts;
+	uint32_t set[2], clr[2], late;
+	uint64_t now, edge;
+	int64_t remain;
+	uint8_t gpio, bank, any;
+
+	pthread_mutex_lock(&softpwm_lock);
+	while (softpwm_running) {
+		now = rpio_timestamp();
+		edge = UINT64_MAX;
+		any = 0;
+
+		for (gpio = 0; gpio < SOFTPWM_CHANNELS; gpio++) {
+			ch = &softpwm_channels[gpio];
+			if (!ch->active)
+				continue;
+			any = 1;
+			edge = std::min(edge, ch->stopping ? now : ch->next);
+		}
+
+		if (!any) {
+			pthread_cond_wait(&softpwm_cond, &softpwm_lock);
+			continue;
+		}
+
+		remain = (int64_t)(edge - now);
+		if (remain > 450) {
+			remain -= 200;
+			clock_gettime(CLOCK_MONOTONIC, &ts);
+			ts.tv_sec += remain / 1000000;
+			ts.tv_nsec += (remain % 1000000) * 1000;
+			if (ts.tv_nsec >= 1000000000) {
+				ts.tv_sec++;
+				ts.tv_nsec -= 1000000000;
+			}
+			pthread_cond_timedwait(&softpwm_cond, &softpwm_lock,
+			    &ts);
+			continue;
+		}
+
+		set[0] = set[1] = clr[0] = clr[1] = 0;
+		for (gpio = 0; gpio < SOFTPWM_CHANNELS; gpio++) {
+			ch = &softpwm_channels[gpio];
+			if (ch->active && (ch->stopping ||
+			    ch->next <= edge + SOFTPWM_WINDOW))
+				softpwm_advance(gpio, now, set, clr);
+		}
+		pthread_mutex_unlock(&softpwm_lock);
+
+		late = rpio_wait_until((uint32_t)edge);
+		for (bank = 0; bank < 2; bank++) {
+			if (set[bank] | clr[bank])
+				bcm2835_gpio_write_mask_bank(bank, set[bank],
+				    set[bank] | clr[bank]);
+		}
+
+		pthread_mutex_lock(&softpwm_lock);
+		softpwm_edges++;
+		softpwm_late_sum += late;
+		softpwm_late_max = std::max(softpwm_late_max, late);
+	}
+	pthread_mutex_unlock(&softpwm_lock);
+
+	return NULL;
+}
+
+static void
+softpwm_stop(void)
+{
+	if (!softpwm_running)
+		return;
+
+	pthread_mutex_lock(&softpwm_lock);
+	softpwm_running = 0;
+	pthread_cond_signal(&softpwm_cond);
+	pthread_mutex_unlock(&softpwm_lock);
+	pthread_join(softpwm_thread, NULL);
+	pthread_cond_destroy(&softpwm_cond);
+
+	memset(softpwm_channels, 0, sizeof(softpwm_channels));
+	softpwm_edges = softpwm_late_max = softpwm_late_sum = 0;
+}
+
+static bool
+softpwm_start(void)
+{
+	pthread_condattr_t attr;
+
+	if (softpwm_running)
+		return true;
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&softpwm_cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	softpwm_running = 1;
+	if (pthread_create(&softpwm_thread, NULL, softpwm_main, NULL) != 0) {
+		softpwm_running = 0;
+		pthread_cond_destroy(&softpwm_cond);
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Start a channel, or change the period and high time of a running one from
+ * its next period onwards.
+ */
+NAN_METHOD(gpio_softpwm_set)
+{
+	ASSERT_ARGC3(IS_U32, IS_U32, IS_U32);
+
+	uint32_t gpio = FROM_U32(0);
+	uint32_t period = FROM_U32(1);
+	uint32_t high = FROM_U32(2);
+	struct softpwm_channel *ch, *other;
+
+	if (soctype != RPIO_SOC_BCM2835)
+		return ThrowError("Software PWM is only supported on bcm2835");
+	if (gpio >= SOFTPWM_CHANNELS)
+		return ThrowRangeError("Invalid pin");
+	if (period == 0)
+		return ThrowRangeError("Period must be non-zero");
+	if (!softpwm_start())
+		return ThrowError("Could not start software PWM thread");
+
+	pthread_mutex_lock(&softpwm_lock);
+	ch = &softpwm_channels[gpio];
+	ch->new_period = period;
+	ch->new_high = std::min(high, period);
+	if (!ch->active || ch->stopping) {
+		ch->active = ch->rising = 1;
+		ch->stopping = 0;
+		ch->next = rpio_timestamp();
+		/*
+		 * Line a new channel up with the next period of any existing
+		 * one at the same rate so that their rising edges batch.
+		 */
+		for (uint32_t i = 0; i < SOFTPWM_CHANNELS; i++) {
+			other = &softpwm_channels[i];
+			if (i != gpio && other->active && !other->stopping &&
+			    other->period == period) {
+				ch->next = other->rising ? other->next :
+				    other->start + other->period;
+				break;
+			}
+		}
+	}
+	pthread_cond_signal(&softpwm_cond);
+	pthread_mutex_unlock(&softpwm_lock);
+}
+
+/*
+ * Stop a channel, driving it low.
+ */
+NAN_METHOD(gpio_softpwm_clear)
+{
+	ASSERT_ARGC1(IS_U32);
+
+	uint32_t gpio = FROM_U32(0);
+
+	if (gpio >= SOFTPWM_CHANNELS)
+		return ThrowRangeError("Invalid pin");
+
+	pthread_mutex_lock(&softpwm_lock);
+	if (softpwm_channels[gpio].active) {
+		softpwm_channels[gpio].stopping = 1;
+		pthread_cond_signal(&softpwm_cond);
+	}
+	pthread_mutex_unlock(&softpwm_lock);
+}
+
+/*
+ * Return and reset the lateness statistics as [edges, max, mean].
+ */
+NAN_METHOD(gpio_softpwm_stats)
+{
+	double stats[3];
+
+	pthread_mutex_lock(&softpwm_lock);
+	stats[0] = softpwm_edges;
+	stats[1] = softpwm_late_max;
+	stats[2] = softpwm_edges ? (double)softpwm_late_sum / softpwm_edges : 0;
+	softpwm_edges = softpwm_late_max = softpwm_late_sum = 0;
+	pthread_mutex_unlock(&softpwm_lock);
+
+	v8::Local<v8::ArrayBuffer> ab = v8::ArrayBuffer::New(
+	    v8::Isolate::GetCurrent(), sizeof(stats));
+	v8::Local<v8::Float64Array> out = v8::Float64Array::New(ab, 0, 3);
+	Nan::TypedArrayContents<double> contents(out);
+	memcpy(*contents, stats, sizeof(stats));
+
+	NAN_RETURN(out);
+}
+
+/*
+ * General purpose clocks.
+ */
+NAN_METHOD(gpclk_start)
+{
+	ASSERT_ARGC5(IS_U32, IS_U32, IS_U32, IS_U32, IS_U32);
+
+	uint32_t clock = FROM_U32(0);
+	uint32_t source = FROM_U32(1);
+	uint32_t divi = FROM_U32(2);
+	uint32_t divf = FROM_U32(3);
+	uint32_t mash = FROM_U32(4);
+
+	if (soctype != RPIO_SOC_BCM2835)
+		return ThrowError("Clocks are only supported on bcm2835");
+	if (clock > 2)
+		return ThrowRangeError("Invalid clock");
+
+	bcm2835_gpclk_start(clock, source, divi, divf, mash);
+}
+
+NAN_METHOD(gpclk_stop)
+{
+	ASSERT_ARGC1(IS_U32);
+
+	uint32_t clock = FROM_U32(0);
+
+	if (clock > 2)
+		return ThrowRangeError("Invalid clock");
+
+	bcm2835_gpclk_stop(clock);
+}
+
 /*
  * SPI functions.
  */
@@ -506,6 +3069,153 @@ NAN_METHOD(spi_end)
 	bcm2835_spi_end();
 }
 
+/*
+ * Micro-programs.  A program is a Uint32Array of opcodes, each followed by a
+ * fixed number of operands, which is run start to finish in a single call so
+ * that sequences which would otherwise be many separate JS calls execute with
+ * consistent timing.  Pins are raw GPIO numbers, already translated by JS.
+ *
+ * Reads, waits, and i2c transfers store their result in a slot of a caller
+ * supplied Uint32Array.  A wait which times out or an i2c transfer which
+ * fails stops the program.  SPI and i2c transfers operate on ranges of a
+ * separate data buffer, with SPI transfers performed in place.
+ */
+#define PROG_WRITE		0x1	/* gpio, value */
+#define PROG_WRITE_MASK		0x2	/* bank, value, mask */
+#define PROG_READ		0x3	/* gpio, slot */
+#define PROG_DELAY		0x4	/* usecs */
+#define PROG_WAIT		0x5	/* gpio, level, timeout, slot */
+#define PROG_SPI		0x6	/* offset, length */
+#define PROG_I2C_ADDR		0x7	/* address */
+#define PROG_I2C_WRITE		0x8	/* offset, length, slot */
+#define PROG_I2C_READ		0x9	/* offset, length, slot */
+
+#define PROG_TIMEOUT		0xffffffff
+
+static const uint8_t prog_argc[] = { 0, 2, 3, 2, 1, 4, 2, 1, 3, 3 };
+
+/*
+ * Check the whole program before running any of it, so that a bad program
+ * throws without having performed half of its I/O.
+ */
+static const char *
+prog_check(uint32_t *prog, uint32_t len, uint32_t nslots, uint32_t datalen)
+{
+	uint32_t *op;
+	uint32_t pc;
+
+	for (pc = 0; pc < len; pc += 1 + prog_argc[prog[pc]]) {
+		if (prog[pc] == 0 || prog[pc] >= sizeof(prog_argc))
+			return "Invalid opcode";
+		if (pc + prog_argc[prog[pc]] >= len)
+			return "Truncated instruction";
+
+		op = &prog[pc + 1];
+		switch (prog[pc]) {
+		case PROG_WRITE:
+		case PROG_READ:
+		case PROG_WAIT:
+			if (op[0] > 53)
+				return "Invalid pin";
+			break;
+		case PROG_WRITE_MASK:
+			if (op[0] > RPIO_PORT_BANK1)
+				return "Invalid bank";
+			break;
+		case PROG_SPI:
+		case PROG_I2C_WRITE:
+		case PROG_I2C_READ:
+			if ((uint64_t)op[0] + op[1] > datalen)
+				return "Transfer beyond end of data buffer";
+			break;
+		}
+
+		switch (prog[pc]) {
+		case PROG_READ:
+			if (op[1] >= nslots)
+				return "Invalid slot";
+			break;
+		case PROG_WAIT:
+			if (op[3] >= nslots)
+				return "Invalid slot";
+			break;
+		case PROG_I2C_WRITE:
+		case PROG_I2C_READ:
+			if (op[2] >= nslots)
+				return "Invalid slot";
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+NAN_METHOD(gpio_run)
+{
+	ASSERT_ARGC5(IS_U32A, IS_U32, IS_U32A, IS_OBJ, IS_U32);
+
+	Nan::TypedArrayContents<uint32_t> progarr(info[0]);
+	Nan::TypedArrayContents<uint32_t> slotarr(info[2]);
+	uint32_t len = FROM_U32(1);
+	char *data = FROM_OBJ(3);
+	uint32_t datalen = FROM_U32(4);
+	uint32_t *prog = *progarr;
+	uint32_t *slots = *slotarr;
+	uint32_t *op;
+	uint32_t pc, start, now;
+	const char *err;
+
+	if (soctype != RPIO_SOC_BCM2835)
+		return ThrowError("Programs are only supported on bcm2835");
+	if (len > progarr.length())
+		return ThrowRangeError("Array not large enough for request");
+	if ((err = prog_check(prog, len, slotarr.length(), datalen)))
+		return ThrowRangeError(err);
+
+	for (pc = 0; pc < len; pc += 1 + prog_argc[prog[pc]]) {
+		op = &prog[pc + 1];
+		switch (prog[pc]) {
+		case PROG_WRITE:
+			bcm2835_gpio_write(op[0], op[1]);
+			break;
+		case PROG_WRITE_MASK:
+			bcm2835_gpio_write_mask_bank(op[0], op[1], op[2]);
+			break;
+		case PROG_READ:
+			slots[op[1]] = bcm2835_gpio_lev(op[0]);
+			break;
+		case PROG_DELAY:
+			rpio_wait_until(rpio_timestamp32() + op[0]);
+			break;
+		case PROG_WAIT:
+			start = now = rpio_timestamp32();
+			while (bcm2835_gpio_lev(op[0]) != op[1]) {
+				now = rpio_timestamp32();
+				if (now - start >= op[2]) {
+					slots[op[3]] = PROG_TIMEOUT;
+					return;
+				}
+			}
+			slots[op[3]] = now - start;
+			break;
+		case PROG_SPI:
+			bcm2835_spi_transfern(data + op[0], op[1]);
+			break;
+		case PROG_I2C_ADDR:
+			bcm2835_i2c_setSlaveAddress(op[0]);
+			break;
+		case PROG_I2C_WRITE:
+			if ((slots[op[2]] = bcm2835_i2c_write(data + op[0], op[1])))
+				return;
+			break;
+		case PROG_I2C_READ:
+			if ((slots[op[2]] = bcm2835_i2c_read(data + op[0], op[1])))
+				return;
+			break;
+		}
+	}
+}
+
 /*
  * Initialize the bcm2835 interface and check we have permission to access it.
  */
@@ -532,6 +3242,16 @@ NAN_METHOD(rpio_init)
 
 NAN_METHOD(rpio_close)
 {
+	/* Background threads must not outlive the register mappings. */
+	event_stop();
+	stream_stop(&gpio_stream);
+	stream_stop(&pwm_stream);
+	sched_stop();
+	softpwm_stop();
+	ramp_stop();
+	edge_drain();
+	pwm_clock_drain();
+
 	bcm2835_close();
 }
 
@@ -547,21 +3267,54 @@ NAN_METHOD(rpio_usleep)
 	usleep(microseconds);
 }
 
+/*
+ * Current system timer value, the timebase used by the scheduler.
+ */
+NAN_METHOD(rpio_now)
+{
+	NAN_RETURN((double)rpio_timestamp());
+}
+
 NAN_MODULE_INIT(setup)
 {
 	NAN_EXPORT(target, rpio_init);
 	NAN_EXPORT(target, rpio_close);
 	NAN_EXPORT(target, rpio_usleep);
+	NAN_EXPORT(target, rpio_now);
 	NAN_EXPORT(target, gpio_function);
 	NAN_EXPORT(target, gpio_read);
 	NAN_EXPORT(target, gpio_readbuf);
+	NAN_EXPORT(target, gpio_readbuf_packed);
+	NAN_EXPORT(target, gpio_readbuf_timed);
+	NAN_EXPORT(target, gpio_read_edges);
+	NAN_EXPORT(target, gpio_sample);
+	NAN_EXPORT(target, gpio_capture);
+	NAN_EXPORT(target, gpio_capture_trigger);
+	NAN_EXPORT(target, gpio_read_port);
 	NAN_EXPORT(target, gpio_write);
+	NAN_EXPORT(target, gpio_write_mask);
 	NAN_EXPORT(target, gpio_writebuf);
+	NAN_EXPORT(target, gpio_writebuf_timed);
+	NAN_EXPORT(target, gpio_write_mask_timed);
 	NAN_EXPORT(target, gpio_pad_read);
 	NAN_EXPORT(target, gpio_pad_write);
 	NAN_EXPORT(target, gpio_pud);
 	NAN_EXPORT(target, gpio_event_set);
-	NAN_EXPORT(target, gpio_event_poll);
+	NAN_EXPORT(target, gpio_event_start);
+	NAN_EXPORT(target, gpio_event_mask);
+	NAN_EXPORT(target, gpio_event_stop);
+	NAN_EXPORT(target, gpio_wait_edge);
+	NAN_EXPORT(target, gpio_wait_edge_async);
+	NAN_EXPORT(target, gpio_stream_open);
+	NAN_EXPORT(target, gpio_stream_write);
+	NAN_EXPORT(target, gpio_stream_end);
+	NAN_EXPORT(target, gpio_stream_close);
+	NAN_EXPORT(target, gpio_sched_start);
+	NAN_EXPORT(target, gpio_sched_write);
+	NAN_EXPORT(target, gpio_sched_capture);
+	NAN_EXPORT(target, gpio_sched_cancel);
+	NAN_EXPORT(target, gpio_sched_stop);
+	NAN_EXPORT(target, gpio_run);
 	NAN_EXPORT(target, gpio_event_clear);
 	NAN_EXPORT(target, i2c_begin);
 	NAN_EXPORT(target, i2c_set_clock_divider);
@@ -573,9 +3326,24 @@ NAN_MODULE_INIT(setup)
 	NAN_EXPORT(target, i2c_write_read_rs);
 	NAN_EXPORT(target, i2c_read_register_rs);
 	NAN_EXPORT(target, pwm_set_clock);
+	NAN_EXPORT(target, pwm_set_clock_async);
+	NAN_EXPORT(target, pwm_configure);
+	NAN_EXPORT(target, gpclk_start);
+	NAN_EXPORT(target, gpclk_stop);
+	NAN_EXPORT(target, pwm_stream_open);
+	NAN_EXPORT(target, pwm_stream_write);
+	NAN_EXPORT(target, pwm_stream_end);
+	NAN_EXPORT(target, pwm_stream_close);
 	NAN_EXPORT(target, pwm_set_mode);
 	NAN_EXPORT(target, pwm_set_range);
 	NAN_EXPORT(target, pwm_set_data);
+	NAN_EXPORT(target, pwm_set_data_pair);
+	NAN_EXPORT(target, pwm_ramp_start);
+	NAN_EXPORT(target, pwm_ramp);
+	NAN_EXPORT(target, pwm_ramp_cancel);
+	NAN_EXPORT(target, gpio_softpwm_set);
+	NAN_EXPORT(target, gpio_softpwm_clear);
+	NAN_EXPORT(target, gpio_softpwm_stats);
 	NAN_EXPORT(target, spi_begin);
 	NAN_EXPORT(target, spi_chip_select);
 	NAN_EXPORT(target, spi_set_cs_polarity);
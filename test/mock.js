@@ -56,8 +56,339 @@ tap.test('rpio write', function (t) {
 	t.end();
 });
 
+tap.test('rpio readbufPacked', function (t) {
+	var buf = Buffer.alloc(3);
+	rpio.open(12, rpio.OUTPUT, rpio.HIGH);
+	rpio.readbufPacked(12, buf);
+	tap.same(Array.prototype.slice.call(buf), [0xff, 0xff, 0xff]);
+	buf.fill(0);
+	rpio.readbufPacked(12, buf, 12);
+	tap.same(Array.prototype.slice.call(buf), [0xff, 0xf0, 0x00]);
+	tap.throws(function() { rpio.readbufPacked(12, buf, 25); },
+	    {message: 'Buffer not large enough to accommodate request'});
+	rpio.close(12);
+	t.end();
+});
+
+tap.test('rpio readEdges', function (t) {
+	rpio.open(12, rpio.OUTPUT, rpio.HIGH);
+	var edges = new Uint32Array(3);
+	tap.equal(rpio.readEdges(12, edges, 1000), 1);
+	tap.same(Array.prototype.slice.call(edges, 0, 2), [0, 1]);
+	tap.throws(function() { rpio.readEdges(12, new Uint32Array(1), 1000); },
+	    {message: 'Edge array not large enough to accommodate request'});
+	tap.throws(function() { rpio.readEdges(12, edges); },
+	    {message: 'Timeout must be a positive number of microseconds'});
+	rpio.close(12);
+	t.end();
+});
+
+tap.test('rpio readbufTimed', function (t) {
+	var buf = Buffer.alloc(16);
+	rpio.readbufTimed(11, buf, new Uint32Array(16));
+	rpio.readbufTimed(11, buf, new Uint32Array(4), 4);
+	rpio.readbufTimed(11, buf, new Uint32Array(3), 4, 12);
+	tap.throws(function() {
+		rpio.readbufTimed(11, buf, new Uint32Array(3), 4);
+	}, {message: 'Timestamp array not large enough to accommodate request'});
+	[0, -1, 1.5].forEach(function (every) {
+		tap.throws(function() {
+			rpio.readbufTimed(11, buf, new Uint32Array(16), every);
+		}, {message: 'Timestamp interval must be a positive integer'});
+	});
+	t.end();
+});
+
+tap.test('rpio readPort', function (t) {
+	rpio.open(11, rpio.OUTPUT, rpio.HIGH);
+	rpio.open(12, rpio.OUTPUT, rpio.LOW);
+	rpio.open(13, rpio.OUTPUT, rpio.HIGH);
+	tap.equal(rpio.readPort([11, 12, 13]), 0x5);
+	tap.equal(rpio.readPort() & (1 << 17), (1 << 17));
+	rpio.close(11);
+	rpio.close(12);
+	rpio.close(13);
+	t.end();
+});
+
+tap.test('rpio writeMask', function (t) {
+	rpio.open(11, rpio.OUTPUT, rpio.LOW);
+	rpio.open(12, rpio.OUTPUT, rpio.LOW);
+	rpio.open(13, rpio.OUTPUT, rpio.HIGH);
+	rpio.writeMask(0x3, [11, 12, 13]);
+	tap.equal(rpio.readPort([11, 12, 13]), 0x3);
+	rpio.writeMask(0x0, (1 << 17));
+	tap.equal(rpio.read(11), rpio.LOW);
+	rpio.close(11);
+	rpio.close(12);
+	rpio.close(13);
+	t.end();
+});
+
+tap.test('rpio capture', function (t) {
+	var words = new Uint32Array(16);
+	rpio.capture(words, [11, 12]);
+	tap.throws(function () { rpio.capture(words, []); });
+	tap.throws(function () { rpio.capture(words, [11], 17); });
+	rpio.samplePort(rpio.PORT_BANK0, words, 1000);
+	tap.throws(function () { rpio.samplePort(rpio.PORT_ALL, words, 1000); });
+	tap.throws(function () { rpio.samplePort(2, words, 1000); });
+	t.end();
+});
+
+tap.test('rpio captureTrigger', function (t) {
+	var words = new Uint32Array(8);
+	var stamps = new Uint32Array(8);
+	rpio.captureTrigger(words, stamps, 4, [{pins: [11], value: 1}], 1000);
+	tap.throws(function () {
+		rpio.captureTrigger(words, stamps, 8, [{pins: [11], value: 1}], 1000);
+	});
+	tap.throws(function () {
+		rpio.captureTrigger(words, stamps, 4, [], 1000);
+	});
+	t.end();
+});
+
+tap.test('rpio writeWave', function (t) {
+	var levels = Buffer.from([1, 0, 1]);
+	rpio.open(13, rpio.OUTPUT, rpio.LOW);
+	rpio.writeWave(13, levels, 50);
+	tap.equal(rpio.read(13), 1);
+	rpio.writeWave(13, levels, new Uint32Array([10, 20]), 2);
+	tap.equal(rpio.read(13), 0);
+	tap.doesNotThrow(function() { rpio.writeWave(13, levels, [10, 20, 30]); });
+	tap.throws(function() { rpio.writeWave(13, levels, [10, 20]); },
+	    {message: 'Not enough durations to accommodate request'});
+	rpio.close(13);
+	t.end();
+});
+
+tap.test('rpio writeMaskWave', function (t) {
+	rpio.open(11, rpio.OUTPUT, rpio.LOW);
+	rpio.open(12, rpio.OUTPUT, rpio.LOW);
+	rpio.writeMaskWave(new Uint32Array([0x1, 0x2, 0x3, 0x2]), [11, 12], 10);
+	tap.equal(rpio.readPort([11, 12]), 0x2);
+	rpio.close(11);
+	rpio.close(12);
+	t.end();
+});
+
+tap.test('rpio createWriteStream', function (t) {
+	rpio.open(11, rpio.OUTPUT, rpio.LOW);
+	rpio.open(12, rpio.OUTPUT, rpio.LOW);
+	var ws = rpio.createWriteStream([11, 12], 8000);
+	ws.on('finish', function() {
+		tap.equal(rpio.readPort([11, 12]), 0x1);
+		rpio.close(11);
+		rpio.close(12);
+		t.end();
+	});
+	ws.write(Buffer.from([0x3, 0x2]));
+	ws.end(Buffer.from([0x1]));
+});
+
+tap.test('rpio program', function (t) {
+	rpio.open(11, rpio.OUTPUT, rpio.LOW);
+	rpio.open(12, rpio.OUTPUT, rpio.LOW);
+	var prog = rpio.program()
+		.write(11, rpio.HIGH)
+		.read(11)
+		.writeMask(0x2, [11, 12])
+		.read(11)
+		.read(12);
+	tap.same(Array.from(rpio.run(prog)), [1, 0, 1]);
+	rpio.close(11);
+	rpio.close(12);
+	t.end();
+});
+
+tap.test('rpio waitForEdge', function (t) {
+	rpio.open(11, rpio.INPUT);
+	tap.equal(rpio.waitForEdge(11, rpio.POLL_HIGH, 1000), -1);
+	var p = rpio.waitForEdgeAsync(11, rpio.POLL_HIGH, 1000);
+	tap.throws(function() { rpio.poll(11, function () {}); });
+	p.then(function (usecs) {
+		tap.equal(usecs, -1);
+		rpio.close(11);
+		t.end();
+	});
+});
+
+tap.test('rpio scheduler', function (t) {
+	rpio.open(11, rpio.OUTPUT, rpio.LOW);
+	var now = rpio.now();
+	tap.ok(rpio.cancel(rpio.scheduleWrite(now + 1000, 0x1, [11])));
+	tap.throws(function() {
+		rpio.scheduleCapture(now, rpio.PORT_ALL, new Uint32Array(4), 1000);
+	}, {message: 'Invalid bank ' + rpio.PORT_ALL});
+	tap.throws(function() {
+		rpio.scheduleCapture(now, 0, new Uint32Array(4), 2000000);
+	}, {message: 'Sample rate must be 1Hz - 1MHz'});
+	rpio.scheduleToggle(now + 1000, [11], function (late) {
+		tap.equal(rpio.read(11), 1);
+		rpio.close(11);
+		t.end();
+	});
+});
+
+tap.test('rpio scheduler does not hold the process open', function (t) {
+	var script = 'var rpio = require(' +
+	    JSON.stringify(require.resolve('../lib/rpio.js')) + ');' +
+	    'rpio.init({mock: "raspi-3"});' +
+	    'rpio.open(11, rpio.OUTPUT);' +
+	    'rpio.scheduleToggle(rpio.now() + 1000, [11]);';
+	var child = require('child_process').spawnSync(process.execPath,
+	    ['-e', script], {timeout: 10000});
+	tap.equal(child.status, 0);
+	t.end();
+});
+
+tap.test('rpio softPwm', function (t) {
+	rpio.open(11, rpio.OUTPUT, rpio.LOW);
+	rpio.softPwm(11, 200, 1);
+	tap.equal(rpio.read(11), 1);
+	rpio.softPwmStop(11);
+	tap.equal(rpio.read(11), 0);
+	tap.throws(function() { rpio.softPwm(11, 200, 1.5); });
+	tap.throws(function() { rpio.servo(11, 3000); });
+	tap.throws(function() { rpio.servoStop(11); });
+	rpio.servo(11, 1500);
+	rpio.softPwmStop(11);
+	tap.throws(function() { rpio.servoStop(11); });
+	rpio.servo(11, 1500);
+	rpio.close(11);
+	tap.throws(function() { rpio.servoStop(11); });
+	t.end();
+});
+
+tap.test('rpio pwmRamp', function (t) {
+	rpio.pwmRamp(12, 0, 1024, 5, rpio.EASE_OUT, function () {
+		tap.pass();
+		t.end();
+	});
+});
+
+tap.test('rpio pwmRamp does not hold the process open', function (t) {
+	var script = 'var rpio = require(' +
+	    JSON.stringify(require.resolve('../lib/rpio.js')) + ');' +
+	    'rpio.init({mock: "raspi-3"});' +
+	    'rpio.pwmRamp(12, 0, 1024, 5, function () {});';
+	var child = require('child_process').spawnSync(process.execPath,
+	    ['-e', script], {timeout: 10000});
+	tap.equal(child.status, 0);
+	t.end();
+});
+
+tap.test('rpio pwmSetClockDividerAsync', function (t) {
+	tap.throws(function() { rpio.pwmSetClockDividerAsync(3, function () {}); });
+	rpio.pwmSetClockDividerAsync(64).then(function () {
+		tap.pass();
+		t.end();
+	});
+});
+
+tap.test('rpio createPwmStream', function (t) {
+	var ws = rpio.createPwmStream(12);
+	tap.throws(function() { rpio.createPwmStream(12); });
+	ws.on('finish', function() {
+		tap.doesNotThrow(function() { rpio.createPwmStream(12).end(); });
+		t.end();
+	});
+	ws.end(Buffer.alloc(16));
+});
+
+tap.test('rpio pwmConfigure and pwmSetDataPair', function (t) {
+	tap.throws(function() {
+		rpio.pwmConfigure([{pin: 12, frequency: 1000},
+		    {pin: 32, frequency: 2000}]);
+	});
+	tap.throws(function() {
+		rpio.pwmConfigure([{pin: 12, frequency: 1000, duty: 2}]);
+	});
+	tap.throws(function() { rpio.pwmConfigure([]); },
+	    {message: 'At least one PWM pin must be given'});
+	tap.throws(function() {
+		rpio.pwmPlan([{pin: 12, frequency: 1000, resolution: 0}]);
+	}, {message: 'Resolution must be at least 1'});
+	tap.throws(function() { rpio.pwmSetDataPair(12, 0, 32, 0); });
+	tap.doesNotThrow(function() { rpio.pwmSetDataPair(12, 0, 35, 0); });
+	t.end();
+});
+
+tap.test('rpio gpclk', function (t) {
+	tap.throws(function() { rpio.gpclkStart(7, rpio.GPCLK_SRC_OSC, 10); },
+	    {message: 'Clocks not available in gpiomem mode'});
+	rpio.init({mock: 'raspi-3', gpiomem: false});
+	tap.throws(function() { rpio.gpclkStart(11, rpio.GPCLK_SRC_OSC, 10); },
+	    {message: 'Pin 11 does not support a clock output'});
+	tap.throws(function() { rpio.gpclkStart(7, rpio.GPCLK_SRC_OSC, 2.5, 3); },
+	    {message: 'Clock divisor out of range for MASH mode 3'});
+	tap.throws(function() { rpio.gpclkStart(7, rpio.GPCLK_SRC_OSC, 10, 4); },
+	    {message: 'MASH mode must be between 0 and 3'});
+	tap.throws(function() { rpio.gpclkStart(7, 2, 10); },
+	    {message: 'Unsupported clock source 2'});
+	tap.doesNotThrow(function() {
+		rpio.gpclkStart(7, rpio.GPCLK_SRC_OSC, 19200000 / 38000);
+		rpio.gpclkStop(7);
+	});
+	rpio.init({mock: 'raspi-3', gpiomem: true});
+	t.end();
+});
+
 tap.test('rpio polling', function (t) {
 	rpio.poll(15, function () {});
 	rpio.poll(15, null);
 	t.end();
 });
+
+tap.test('rpio polling unpolled from its own callback', function (t) {
+	var count = 0;
+
+	rpio.write(16, rpio.LOW);
+	rpio.poll(16, function (pin) {
+		count++;
+		rpio.poll(pin, null);
+		setImmediate(function () {
+			rpio.write(16, rpio.LOW);
+			rpio.write(16, rpio.HIGH);
+			setImmediate(function () {
+				tap.equal(count, 1);
+				t.end();
+			});
+		});
+	});
+	rpio.write(16, rpio.HIGH);
+});
+
+tap.test('rpio edges event', function (t) {
+	var order = [];
+
+	function onedges(edges, dropped) {
+		order.push('edges');
+		tap.same(Array.prototype.slice.call(edges, 0, 2), [15, 1]);
+		tap.equal(edges.length, 3);
+		tap.equal(dropped, 0);
+	}
+
+	rpio.on('edges', onedges);
+	rpio.write(15, rpio.LOW);
+	rpio.poll(15, function (pin) {
+		order.push(pin);
+		rpio.removeListener('edges', onedges);
+		rpio.poll(15, null);
+		tap.same(order, ['edges', 15]);
+		t.end();
+	}, rpio.POLL_HIGH);
+	rpio.write(15, rpio.HIGH);
+	rpio.write(15, rpio.HIGH);
+});
+
+tap.test('rpio polling compute module bank 1', function (t) {
+	rpio.init({mock: 'cm4', mapping: 'gpio'});
+	rpio.poll(44, function () {});
+	rpio.poll(2, function () {});
+	rpio.poll(44, null);
+	rpio.poll(2, null);
+	rpio.init({mock: 'raspi-3', mapping: 'physical'});
+	t.end();
+});